@@ -0,0 +1,215 @@
+/*************************************************
+* \file      countCheckpoint.c
+* \details   keeps a copy of count stats in a memory mapped
+*            file so they survive a restart of the process.
+*************************************************/
+
+/****************** Includes ************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "countCheckpoint.h"
+
+/****************** Defines *************************/
+#define CHECKPOINT_MAGIC   0x43535450 /* "CSTP" */
+#define CHECKPOINT_VERSION 1
+
+/****************** Structs and Typedefs ************/
+struct CountCheckpoint
+{
+    CheckpointFile    *p_file;
+
+    /* sequence of the newest good record, 0 if there is none */
+    unsigned long long sequence;
+};
+
+/****************** Private Functions ***************/
+
+/**
+ * \brief   FNV-1a checksum of a record's sequence and stats
+ */
+static unsigned int record_checksum(const CheckpointRecord *p_record)
+{
+    const unsigned char *p_byte = (const unsigned char *)p_record;
+    const unsigned char *p_end  = (const unsigned char *)&p_record->checksum;
+    unsigned int         hash   = 2166136261u;
+
+    while (p_byte < p_end)
+    {
+        hash = (hash ^ *p_byte++) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * \brief   Checks a record was completely written
+ */
+static bool record_valid(const CheckpointRecord *p_record)
+{
+    return (0 != p_record->sequence) && (record_checksum(p_record) == p_record->checksum);
+}
+
+/****************** Public Functions ****************/
+
+/**
+ * \brief   Opens (creating if needed) and maps a checkpoint file
+ * \details A file that is missing, the wrong size or from another
+ *          version is reinitialized with no saved stats.
+ *
+ * \param p_path - path of the checkpoint file
+ *
+ * \return CountCheckpoint* - NULL if it fails.
+ */
+CountCheckpoint *count_checkpoint_open(const char *p_path)
+{
+    CountCheckpoint *p_checkpoint = NULL;
+    CheckpointFile  *p_file       = NULL;
+    struct stat      file_stat;
+    bool             fresh        = false;
+    int              fd           = -1;
+    int              i            = 0;
+
+    if (!p_path)
+    {
+        printf("p_path is NULL\n");
+        return NULL;
+    }
+
+    fd = open(p_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        printf("failed to open checkpoint %s\n", p_path);
+        return NULL;
+    }
+
+    if ((0 != fstat(fd, &file_stat)) ||
+        ((size_t)file_stat.st_size != sizeof(CheckpointFile)))
+    {
+        fresh = true;
+        if ((0 != ftruncate(fd, 0)) || (0 != ftruncate(fd, sizeof(CheckpointFile))))
+        {
+            printf("failed to size checkpoint %s\n", p_path);
+            close(fd);
+            return NULL;
+        }
+    }
+
+    p_file = mmap(NULL, sizeof(CheckpointFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    /* the mapping keeps the file open */
+    close(fd);
+
+    if (MAP_FAILED == p_file)
+    {
+        printf("failed to map checkpoint %s\n", p_path);
+        return NULL;
+    }
+
+    p_checkpoint = calloc(1, sizeof(CountCheckpoint));
+    if (!p_checkpoint)
+    {
+        munmap(p_file, sizeof(CheckpointFile));
+        return NULL;
+    }
+
+    if (!fresh && ((CHECKPOINT_MAGIC != p_file->magic) ||
+                   (CHECKPOINT_VERSION != p_file->version) ||
+                   (sizeof(CheckpointRecord) != p_file->record_size)))
+    {
+        printf("checkpoint %s is not compatible, starting over\n", p_path);
+        fresh = true;
+    }
+
+    if (fresh)
+    {
+        memset(p_file, 0, sizeof(CheckpointFile));
+        p_file->magic       = CHECKPOINT_MAGIC;
+        p_file->version     = CHECKPOINT_VERSION;
+        p_file->record_size = sizeof(CheckpointRecord);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        if (record_valid(&p_file->records[i]) &&
+            (p_checkpoint->sequence < p_file->records[i].sequence))
+        {
+            p_checkpoint->sequence = p_file->records[i].sequence;
+        }
+    }
+
+    p_checkpoint->p_file = p_file;
+
+    return p_checkpoint;
+}
+
+/**
+ * \brief   Flushes and unmaps a checkpoint, setting the pointer to NULL
+ *
+ * \param pp_checkpoint - pointer to checkpoint handle
+ *
+ * \return void
+ */
+void count_checkpoint_close(CountCheckpoint **pp_checkpoint)
+{
+    if (pp_checkpoint && *pp_checkpoint)
+    {
+        msync((*pp_checkpoint)->p_file, sizeof(CheckpointFile), MS_SYNC);
+        munmap((*pp_checkpoint)->p_file, sizeof(CheckpointFile));
+        free(*pp_checkpoint);
+        *pp_checkpoint = NULL;
+    }
+}
+
+/**
+ * \brief   Gets the newest good stats saved in a checkpoint
+ *
+ * \param p_checkpoint - checkpoint to load from
+ * \param p_stats      - pointer to place stats inside of
+ *
+ * \return bool - false if nothing good has been saved
+ */
+bool count_checkpoint_load(CountCheckpoint *p_checkpoint, CountStats *p_stats)
+{
+    CheckpointRecord *p_record = NULL;
+
+    if (!p_checkpoint || !p_stats || (0 == p_checkpoint->sequence))
+    {
+        return false;
+    }
+
+    p_record = &p_checkpoint->p_file->records[p_checkpoint->sequence & 1];
+    *p_stats = p_record->c_stats;
+
+    return true;
+}
+
+/**
+ * \brief   Saves stats over the older of the two records
+ * \details Writes go to the shared mapping so they survive the process
+ *          crashing, the kernel writes them back to disk on its own.
+ *          Caller is expected to serialize saves.
+ *
+ * \param p_checkpoint - checkpoint to save to, ignored if NULL
+ * \param p_stats      - stats to save
+ *
+ * \return void
+ */
+void count_checkpoint_save(CountCheckpoint *p_checkpoint, const CountStats *p_stats)
+{
+    CheckpointRecord *p_record = NULL;
+
+    if (p_checkpoint && p_stats)
+    {
+        p_checkpoint->sequence++;
+        p_record = &p_checkpoint->p_file->records[p_checkpoint->sequence & 1];
+
+        p_record->sequence = p_checkpoint->sequence;
+        p_record->c_stats  = *p_stats;
+        p_record->checksum = record_checksum(p_record);
+    }
+}
@@ -0,0 +1,42 @@
+/*************************************************
+* \file      countCheckpoint.h
+* \details   keeps a copy of count stats in a memory mapped
+*            file so they survive a restart of the process.
+*************************************************/
+#ifndef __COUNTCHECKPOINT_H
+#define __COUNTCHECKPOINT_H
+
+/****************** Includes ************************/
+#include <stdbool.h>
+#include "countStats.h"
+
+/****************** Structs and Typedefs ************/
+/* One copy of the stats. The checksum covers sequence and stats so a
+   record torn by a crash part way through a save is never loaded. */
+typedef struct CheckpointRecord
+{
+    unsigned long long sequence;
+    CountStats         c_stats;
+    unsigned int       checksum;
+} CheckpointRecord;
+
+/* Layout of the file. Saves alternate between the two records so the
+   previous good copy is never the one being written. */
+typedef struct CheckpointFile
+{
+    unsigned int     magic;
+    unsigned int     version;
+    unsigned int     record_size;
+    CheckpointRecord records[2];
+} CheckpointFile;
+
+/* Handle to an open checkpoint file, layout is private to countCheckpoint.c */
+typedef struct CountCheckpoint CountCheckpoint;
+
+/****************** Public Functions ****************/
+CountCheckpoint *count_checkpoint_open(const char *p_path);
+void count_checkpoint_close(CountCheckpoint **pp_checkpoint);
+bool count_checkpoint_load(CountCheckpoint *p_checkpoint, CountStats *p_stats);
+void count_checkpoint_save(CountCheckpoint *p_checkpoint, const CountStats *p_stats);
+
+#endif /* __COUNTCHECKPOINT_H */
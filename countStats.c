@@ -13,9 +13,35 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
 #include "countStats.h"
+#include "countCheckpoint.h"
 
 /****************** Structs and Typedefs ************/
+/* A consumer waiting on changes instead of polling count_stats_get */
+typedef struct CountSubscriber
+{
+    /* epoll fd handed to the subscriber, watches event_fd and timer_fd */
+    int          poll_fd;
+    int          event_fd;   /* written to wake the subscriber right away */
+    int          timer_fd;   /* wakes it when a held back interval ends */
+    unsigned int min_interval_seconds;
+    unsigned int count_threshold;
+
+    /* A wakeup is already on its way, nothing more to do until the
+       subscriber acks it. Keeps syscalls off the update path. */
+    bool         signalled;
+    bool         timer_armed;
+
+    /* changes since the last time this subscriber acked a wakeup */
+    unsigned long long pending_counts;
+    time_t             last_notify_time;   /* CLOCK_MONOTONIC seconds */
+} CountSubscriber;
+
 /* Private CountStats data */
 struct CStatsHandle 
 {
@@ -23,8 +49,178 @@ struct CStatsHandle
 
     /* Using mutex to make sure I am not reading partially updated data */
     pthread_mutex_t stats_lock;     
+
+    /* NULL unless created with count_stats_new_persistent */
+    CountCheckpoint *p_checkpoint;
+
+    /* protected by stats_lock */
+    CountSubscriber *p_subscribers;
+    size_t           num_subscribers;
 };
 
+/****************** Private Functions ***************/
+
+/**
+ * \brief   Seconds on CLOCK_MONOTONIC, which wall clock steps do not move
+ */
+static time_t monotonic_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+/**
+ * \brief   Closes the fds of a subscriber
+ */
+static void subscriber_close(CountSubscriber *p_sub)
+{
+    if (p_sub->poll_fd >= 0)
+    {
+        close(p_sub->poll_fd);
+    }
+    if (p_sub->timer_fd >= 0)
+    {
+        close(p_sub->timer_fd);
+    }
+    if (p_sub->event_fd >= 0)
+    {
+        close(p_sub->event_fd);
+    }
+
+    p_sub->poll_fd  = -1;
+    p_sub->timer_fd = -1;
+    p_sub->event_fd = -1;
+}
+
+/**
+ * \brief   Creates the fds for a subscriber
+ * 
+ * \param p_sub - subscriber to create fds for
+ * 
+ * \return bool - false if failed, no fds are left open
+ */
+static bool subscriber_open(CountSubscriber *p_sub)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+
+    p_sub->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    p_sub->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    p_sub->poll_fd  = epoll_create1(EPOLL_CLOEXEC);
+
+    if ((p_sub->event_fd < 0) || (p_sub->timer_fd < 0) || (p_sub->poll_fd < 0) ||
+        (0 != epoll_ctl(p_sub->poll_fd, EPOLL_CTL_ADD, p_sub->event_fd, &event)) ||
+        (0 != epoll_ctl(p_sub->poll_fd, EPOLL_CTL_ADD, p_sub->timer_fd, &event)))
+    {
+        subscriber_close(p_sub);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * \brief   Wakes a subscriber now, cancelling any held back wakeup
+ */
+static void subscriber_wake(CountSubscriber *p_sub, time_t now)
+{
+    struct itimerspec disarm;
+    uint64_t          wake = 1;
+
+    if (sizeof(wake) != write(p_sub->event_fd, &wake, sizeof(wake)))
+    {
+        printf("failed to wake subscriber\n");
+    }
+
+    if (p_sub->timer_armed)
+    {
+        memset(&disarm, 0, sizeof(disarm));
+        timerfd_settime(p_sub->timer_fd, 0, &disarm, NULL);
+        p_sub->timer_armed = false;
+    }
+
+    p_sub->signalled        = true;
+    p_sub->last_notify_time = now;
+}
+
+/**
+ * \brief   Wakes a subscriber when its interval ends
+ */
+static void subscriber_hold(CountSubscriber *p_sub)
+{
+    struct itimerspec expire;
+
+    memset(&expire, 0, sizeof(expire));
+    expire.it_value.tv_sec = p_sub->last_notify_time + p_sub->min_interval_seconds;
+
+    if (0 != timerfd_settime(p_sub->timer_fd, TFD_TIMER_ABSTIME, &expire, NULL))
+    {
+        printf("failed to arm subscriber timer\n");
+    }
+    else
+    {
+        p_sub->timer_armed = true;
+    }
+}
+
+/**
+ * \brief   Wakes the subscribers whose interval and threshold have been met
+ * \details Must be called with stats_lock held. A subscriber that has
+ *          already been woken, or has a timer running, is skipped until it
+ *          acks, so most updates make no syscalls at all.
+ * 
+ * \param p_handle - handle the stats changed on
+ * \param count    - counts added by the change
+ * \param now      - CLOCK_MONOTONIC seconds of the change
+ * \param force    - wake every subscriber (stats were reset)
+ * 
+ * \return void
+ */
+static void notify_subscribers(CStatsHandle *p_handle, unsigned int count, time_t now, bool force)
+{
+    CountSubscriber *p_sub = NULL;
+    size_t           i     = 0;
+
+    for (i = 0; i < p_handle->num_subscribers; i++)
+    {
+        p_sub = &p_handle->p_subscribers[i];
+        if (force)
+        {
+            /* counts from before the reset are gone */
+            p_sub->pending_counts = 0;
+            if (!p_sub->signalled)
+            {
+                subscriber_wake(p_sub, now);
+            }
+            continue;
+        }
+
+        p_sub->pending_counts += count;
+
+        if (p_sub->signalled)
+        {
+            continue;
+        }
+
+        if (!p_sub->timer_armed && (p_sub->pending_counts >= p_sub->count_threshold))
+        {
+            if (now - p_sub->last_notify_time >= (time_t)p_sub->min_interval_seconds)
+            {
+                subscriber_wake(p_sub, now);
+            }
+            else
+            {
+                subscriber_hold(p_sub);
+            }
+        }
+    }
+}
+
 /****************** Public Functions ****************/
 
 /**
@@ -51,6 +247,39 @@ CStatsHandle *count_stats_new()
     return p_handle;
 }
 
+/**
+ * \brief   Create a new Count Stats object whose stats are kept in a
+ *          checkpoint file.
+ * \details If the file holds stats saved by an earlier run they are mapped
+ *          back in and counting carries on from them, otherwise stats are
+ *          invalid until data is recieved, same as count_stats_new.
+ *
+ * \param p_checkpoint_path - file to keep the stats in, created if missing
+ *
+ * \return  CStatsHandle* - NULL if it fails.
+ */
+CStatsHandle *count_stats_new_persistent(const char *p_checkpoint_path)
+{
+    CStatsHandle *p_handle = count_stats_new();
+
+    if (p_handle)
+    {
+        p_handle->p_checkpoint = count_checkpoint_open(p_checkpoint_path);
+
+        if (!p_handle->p_checkpoint)
+        {
+            printf("failed to open checkpoint\n");
+            count_stats_destroy(&p_handle);
+        }
+        else
+        {
+            count_checkpoint_load(p_handle->p_checkpoint, &p_handle->c_stats);
+        }
+    }
+
+    return p_handle;
+}
+
 /**
  * \brief Destroys a countStats object and sets the pointer
  *        to NULL. 
@@ -68,6 +297,14 @@ void count_stats_destroy(CStatsHandle **pp_handle)
     if (pp_handle && *pp_handle)
     {
         pthread_mutex_destroy(&(*pp_handle)->stats_lock);
+        count_checkpoint_close(&(*pp_handle)->p_checkpoint);
+
+        while ((*pp_handle)->num_subscribers)
+        {
+            (*pp_handle)->num_subscribers--;
+            subscriber_close(&(*pp_handle)->p_subscribers[(*pp_handle)->num_subscribers]);
+        }
+        free((*pp_handle)->p_subscribers);
         free(*pp_handle);
         *pp_handle = NULL;
     }
@@ -98,6 +335,8 @@ bool count_stats_reset(CStatsHandle *p_handle)
         pthread_mutex_lock(&p_handle->stats_lock);
         /* A zero epoch time will be considered as stats are invalid */
         memset(&p_handle->c_stats, 0, sizeof(CountStats));
+        count_checkpoint_save(p_handle->p_checkpoint, &p_handle->c_stats);
+        notify_subscribers(p_handle, 0, monotonic_seconds(), true);
         pthread_mutex_unlock(&p_handle->stats_lock);
     }
 
@@ -199,9 +438,229 @@ bool count_stats_update(CStatsHandle *p_handle, unsigned int count)
         {
             p_stats->max_cps = count;
         }
- 
+
+        count_checkpoint_save(p_handle->p_checkpoint, p_stats);
+        notify_subscribers(p_handle, count, monotonic_seconds(), false);
         pthread_mutex_unlock(&p_handle->stats_lock);
     }
 
+    return retval;
+}
+
+/**
+ * \brief   Gets the current stats for a given handle and resets them
+ *          as one step
+ * \details For per period reporting. Both happen under one hold of
+ *          stats_lock, so no update can land between the get and the
+ *          reset and lose its counts. Updates wait for the copy and
+ *          clear, same as they wait for count_stats_get.
+ * 
+ * \param p_handle - handle to get and reset stats on.
+ * \param p_stats  - pointer to place the stats of the period inside of
+ * 
+ * \return bool - false if failed or no readings were recieved in the
+ *                period
+ */
+bool count_stats_get_and_reset(CStatsHandle *p_handle, CountStats *p_stats)
+{
+    bool retval = false;
+
+    if (!p_handle)
+    {
+        printf("p_handle is invalid\n");
+    }
+    else if (!p_stats)
+    {
+        printf("p_stats is NULL\n");
+    }
+    else
+    {
+        pthread_mutex_lock(&p_handle->stats_lock);
+
+        if (0 != p_handle->c_stats.first_epoch_time_seconds)
+        {
+            *p_stats = p_handle->c_stats;
+            retval = true;
+        }
+
+        /* A zero epoch time will be considered as stats are invalid */
+        memset(&p_handle->c_stats, 0, sizeof(CountStats));
+        count_checkpoint_save(p_handle->p_checkpoint, &p_handle->c_stats);
+        notify_subscribers(p_handle, 0, monotonic_seconds(), true);
+        pthread_mutex_unlock(&p_handle->stats_lock);
+    }
+
+    return retval;
+}
+
+/**
+ * \brief   Subscribes to changes instead of polling count_stats_get
+ * \details Returns a fd that becomes readable when the stats change. Call
+ *          count_stats_ack once it is readable, then count_stats_get. Wakeups
+ *          are held back until at least count_threshold counts have come in
+ *          and min_interval_seconds have passed since the last wakeup. A
+ *          change held back by the interval wakes the subscriber when the
+ *          interval ends, even if no more updates come in. Resets,
+ *          count_stats_get_and_reset included, always wake subscribers.
+ *          Until it is acked a subscriber is not woken again, so a burst
+ *          of updates costs one wakeup.
+ * 
+ * \param p_handle             - handle to watch
+ * \param min_interval_seconds - minimum time between wakeups, 0 for none
+ * \param count_threshold      - counts needed before a wakeup, 0 for any update
+ * 
+ * \return int - fd to poll on, -1 if failed
+ */
+int count_stats_subscribe(CStatsHandle *p_handle, unsigned int min_interval_seconds,
+                          unsigned int count_threshold)
+{
+    CountSubscriber *p_subscribers = NULL;
+    CountSubscriber  subscriber;
+
+    if (!p_handle)
+    {
+        printf("p_handle is invalid\n");
+        return -1;
+    }
+
+    memset(&subscriber, 0, sizeof(CountSubscriber));
+    subscriber.min_interval_seconds = min_interval_seconds;
+    subscriber.count_threshold      = count_threshold;
+
+    /* the first change does not wait for an interval */
+    subscriber.last_notify_time     = monotonic_seconds() - min_interval_seconds;
+
+    if (!subscriber_open(&subscriber))
+    {
+        printf("failed to create subscriber fds\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&p_handle->stats_lock);
+
+    p_subscribers = realloc(p_handle->p_subscribers,
+                            (p_handle->num_subscribers + 1) * sizeof(CountSubscriber));
+    if (!p_subscribers)
+    {
+        printf("failed to add subscriber\n");
+        subscriber_close(&subscriber);
+    }
+    else
+    {
+        p_handle->p_subscribers = p_subscribers;
+        p_subscribers[p_handle->num_subscribers++] = subscriber;
+    }
+
+    pthread_mutex_unlock(&p_handle->stats_lock);
+
+    return subscriber.poll_fd;
+}
+
+/**
+ * \brief   Acknowledges a wakeup so the subscriber can be woken again
+ * \details Call before count_stats_get so changes made after the get
+ *          wake the subscriber again.
+ * 
+ * \param p_handle - handle the subscriber is watching
+ * \param poll_fd  - fd returned by count_stats_subscribe
+ * 
+ * \return bool - false if failed
+ */
+bool count_stats_ack(CStatsHandle *p_handle, int poll_fd)
+{
+    CountSubscriber *p_sub  = NULL;
+    bool             retval = false;
+    uint64_t         wakes  = 0;
+    size_t           i      = 0;
+
+    if (!p_handle)
+    {
+        printf("p_handle is invalid\n");
+    }
+    else
+    {
+        pthread_mutex_lock(&p_handle->stats_lock);
+
+        for (i = 0; i < p_handle->num_subscribers; i++)
+        {
+            p_sub = &p_handle->p_subscribers[i];
+            if (p_sub->poll_fd != poll_fd)
+            {
+                continue;
+            }
+
+            if (p_sub->signalled &&
+                (sizeof(wakes) == read(p_sub->event_fd, &wakes, sizeof(wakes))))
+            {
+                p_sub->signalled      = false;
+                p_sub->pending_counts = 0;
+            }
+
+            /* the timer going off is the held back wakeup */
+            if (p_sub->timer_armed &&
+                (sizeof(wakes) == read(p_sub->timer_fd, &wakes, sizeof(wakes))))
+            {
+                p_sub->timer_armed      = false;
+                p_sub->pending_counts   = 0;
+                p_sub->last_notify_time = monotonic_seconds();
+            }
+
+            retval = true;
+            break;
+        }
+
+        pthread_mutex_unlock(&p_handle->stats_lock);
+
+        if (!retval)
+        {
+            printf("poll_fd is not subscribed\n");
+        }
+    }
+
+    return retval;
+}
+
+/**
+ * \brief   Removes a subscriber and closes its fds
+ * 
+ * \param p_handle - handle the subscriber is watching
+ * \param poll_fd  - fd returned by count_stats_subscribe
+ * 
+ * \return bool - false if failed
+ */
+bool count_stats_unsubscribe(CStatsHandle *p_handle, int poll_fd)
+{
+    bool   retval = false;
+    size_t i      = 0;
+
+    if (!p_handle)
+    {
+        printf("p_handle is invalid\n");
+    }
+    else
+    {
+        pthread_mutex_lock(&p_handle->stats_lock);
+
+        for (i = 0; i < p_handle->num_subscribers; i++)
+        {
+            if (p_handle->p_subscribers[i].poll_fd == poll_fd)
+            {
+                subscriber_close(&p_handle->p_subscribers[i]);
+
+                /* order does not matter, move the last one into the hole */
+                p_handle->p_subscribers[i] = p_handle->p_subscribers[--p_handle->num_subscribers];
+                retval = true;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&p_handle->stats_lock);
+
+        if (!retval)
+        {
+            printf("poll_fd is not subscribed\n");
+        }
+    }
+
     return retval;
 }
\ No newline at end of file
@@ -62,10 +62,16 @@ typedef struct CountStats
 
 /****************** Public Functions ****************/
 CStatsHandle *count_stats_new();
+CStatsHandle *count_stats_new_persistent(const char *p_checkpoint_path);
 void count_stats_destroy(CStatsHandle **pp_handle);
 bool count_stats_reset(CStatsHandle *p_handle);
 bool count_stats_get(CStatsHandle *p_handle, CountStats *p_stats);
 bool count_stats_update(CStatsHandle *p_handle, unsigned int count);
+bool count_stats_get_and_reset(CStatsHandle *p_handle, CountStats *p_stats);
+int count_stats_subscribe(CStatsHandle *p_handle, unsigned int min_interval_seconds,
+                          unsigned int count_threshold);
+bool count_stats_ack(CStatsHandle *p_handle, int poll_fd);
+bool count_stats_unsubscribe(CStatsHandle *p_handle, int poll_fd);
 /* Note: If required could add functions to get stats individually */
 
 #endif /* __COUNTSTATS_H */
@@ -0,0 +1,311 @@
+/*************************************************
+* \file      coincidenceStats.cpp
+* \details   counts coincidences, events seen on two or more
+*            detectors within a time window of each other.
+*************************************************/
+
+/****************** Includes ************************/
+#include <iostream>
+#include <climits>
+#include "coincidenceStats.hpp"
+
+using namespace std;
+
+/****************** Public Functions ****************/
+
+/**
+ * \brief   Create a coincidence counter
+ *
+ * \param num_detectors - number of detectors, at most COINCIDENCE_MAX_DETECTORS
+ * \param window_ns     - events this close together are a coincidence
+ * \param min_detectors - different detectors needed for a coincidence
+ * \param buffer_events - events each detector can have waiting to be merged,
+ *                        rounded up to a power of 2
+ *
+ */
+CoincidenceStats::CoincidenceStats(unsigned int num_detectors, unsigned long long window_ns,
+                                   unsigned int min_detectors, size_t buffer_events)
+{
+    size_t capacity = 1;
+
+    if (num_detectors > COINCIDENCE_MAX_DETECTORS)
+    {
+        cerr << "too many detectors, only using " << COINCIDENCE_MAX_DETECTORS << endl;
+        num_detectors = COINCIDENCE_MAX_DETECTORS;
+    }
+
+    while (capacity < buffer_events)
+    {
+        capacity *= 2;
+    }
+
+    this->detectors.resize(num_detectors);
+    this->candidate_hits.assign(num_detectors, 0);
+    for (DetectorBuffer &detector : this->detectors)
+    {
+        detector.times_ns.resize(capacity);
+        detector.head         = 0;
+        detector.tail         = 0;
+        detector.watermark_ns = 0;
+    }
+
+    this->window_ns           = window_ns;
+    this->min_detectors       = min_detectors ? min_detectors : 1;
+    this->candidate_detectors = 0;
+    this->window_open         = false;
+    this->window_start_ns     = 0;
+    this->merged_any          = false;
+    this->last_merged_ns      = 0;
+    this->current_second      = 0;
+    this->current_found       = 0;
+}
+
+/**
+ * \brief   Queues an event seen by a detector
+ * \details Events from one detector must be pushed in time order.
+ *
+ * \param detector - detector the event was seen on
+ * \param time_ns  - time of the event
+ *
+ * \return bool - false if the detector is invalid, its buffer is full
+ *                (call coincidence_process) or the event is out of order
+ */
+bool CoincidenceStats::coincidence_push(unsigned int detector, unsigned long long time_ns)
+{
+    DetectorBuffer *p_detector = NULL;
+
+    if (detector >= this->detectors.size())
+    {
+        return false;
+    }
+
+    p_detector = &this->detectors[detector];
+
+    if ((time_ns < p_detector->watermark_ns) ||
+        (p_detector->tail - p_detector->head == p_detector->times_ns.size()))
+    {
+        return false;
+    }
+
+    p_detector->times_ns[p_detector->tail & (p_detector->times_ns.size() - 1)] = time_ns;
+    p_detector->tail++;
+    p_detector->watermark_ns = time_ns;
+
+    return true;
+}
+
+/**
+ * \brief   Tells the merge a detector has seen nothing before a time
+ * \details Merging can only go as far as the slowest detector, so a
+ *          detector that is quiet should call this to let the others
+ *          through.
+ *
+ * \param detector - detector to advance
+ * \param time_ns  - time the detector has been quiet up to
+ *
+ * \return void
+ */
+void CoincidenceStats::coincidence_advance(unsigned int detector, unsigned long long time_ns)
+{
+    if ((detector < this->detectors.size()) &&
+        (this->detectors[detector].watermark_ns < time_ns))
+    {
+        this->detectors[detector].watermark_ns = time_ns;
+    }
+}
+
+/**
+ * \brief   Merges every event that all detectors have moved past
+ * \details Reports every second of event time that is now complete to
+ *          coincidence_stats().
+ *
+ * \return unsigned int - coincidences found
+ */
+unsigned int CoincidenceStats::coincidence_process()
+{
+    unsigned long long safe_ns = ULLONG_MAX;
+    unsigned int       found   = 0;
+
+    for (const DetectorBuffer &detector : this->detectors)
+    {
+        if (detector.watermark_ns < safe_ns)
+        {
+            safe_ns = detector.watermark_ns;
+        }
+    }
+
+    found = this->merge(safe_ns);
+
+    /* nothing later than safe_ns can join a window that ended before it */
+    if (this->window_open && (this->window_start_ns + this->window_ns < safe_ns))
+    {
+        found += this->close_window();
+    }
+
+    /* the earliest a coincidence not counted yet can start */
+    if (this->window_open)
+    {
+        safe_ns = this->window_start_ns;
+    }
+    else if (!this->candidates.empty())
+    {
+        safe_ns = this->candidates.front().time_ns;
+    }
+
+    this->report_seconds(safe_ns / COINCIDENCE_NS_PER_SECOND);
+
+    return found;
+}
+
+/**
+ * \brief   Merges every queued event, for the end of a run
+ * \details Reports every second up to the last event merged, the last
+ *          one as it is even though it may have been cut short.
+ *
+ * \return unsigned int - coincidences found
+ */
+unsigned int CoincidenceStats::coincidence_flush()
+{
+    unsigned int found = this->merge(ULLONG_MAX);
+
+    found += this->close_window();
+
+    if (this->merged_any)
+    {
+        this->report_seconds(this->last_merged_ns / COINCIDENCE_NS_PER_SECOND + 1);
+    }
+
+    return found;
+}
+
+/**
+ * \brief   Stats of the coincidences found
+ */
+CountStats &CoincidenceStats::coincidence_stats()
+{
+    return this->c_stats;
+}
+
+/****************** Private Methods *****************/
+
+/**
+ * \brief   Takes queued events in time order up to a time and finds the
+ *          coincidences among them.
+ *
+ * \param safe_ns - no event later than this is taken
+ *
+ * \return unsigned int - coincidences in the windows closed
+ */
+unsigned int CoincidenceStats::merge(unsigned long long safe_ns)
+{
+    unsigned long long time_ns  = 0;
+    unsigned int       found    = 0;
+    size_t             oldest   = 0;
+    size_t             i        = 0;
+
+    for (;;)
+    {
+        /* k way merge, oldest head across the detectors */
+        oldest  = this->detectors.size();
+        time_ns = ULLONG_MAX;
+        for (i = 0; i < this->detectors.size(); i++)
+        {
+            const DetectorBuffer &detector = this->detectors[i];
+
+            if ((detector.head != detector.tail) &&
+                (detector.times_ns[detector.head & (detector.times_ns.size() - 1)] < time_ns))
+            {
+                oldest  = i;
+                time_ns = detector.times_ns[detector.head & (detector.times_ns.size() - 1)];
+            }
+        }
+
+        if ((oldest == this->detectors.size()) || (safe_ns < time_ns))
+        {
+            break;
+        }
+
+        this->detectors[oldest].head++;
+
+        if (!this->merged_any)
+        {
+            this->merged_any     = true;
+            this->current_second = time_ns / COINCIDENCE_NS_PER_SECOND;
+        }
+        this->last_merged_ns = time_ns;
+
+        if (this->window_open)
+        {
+            if (time_ns - this->window_start_ns <= this->window_ns)
+            {
+                continue;
+            }
+
+            /* past the end, nothing else can join the coincidence */
+            found += this->close_window();
+        }
+
+        this->candidates.push_back({time_ns, (unsigned int)oldest});
+        this->candidate_hits[oldest]++;
+        this->candidate_detectors |= 1u << oldest;
+
+        /* slide the start up to the oldest event still in reach */
+        while (this->candidates.front().time_ns + this->window_ns < time_ns)
+        {
+            if (0 == --this->candidate_hits[this->candidates.front().detector])
+            {
+                this->candidate_detectors &= ~(1u << this->candidates.front().detector);
+            }
+            this->candidates.pop_front();
+        }
+
+        if ((unsigned int)__builtin_popcount(this->candidate_detectors) >= this->min_detectors)
+        {
+            this->window_open     = true;
+            this->window_start_ns = this->candidates.front().time_ns;
+
+            /* the coincidence owns them now */
+            for (const WindowEvent &event : this->candidates)
+            {
+                this->candidate_hits[event.detector] = 0;
+            }
+            this->candidates.clear();
+            this->candidate_detectors = 0;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * \brief   Ends the coincidence being filled, counting it in the second
+ *          it started in.
+ * \return  bool - true if there was one
+ */
+bool CoincidenceStats::close_window()
+{
+    if (!this->window_open)
+    {
+        return false;
+    }
+
+    /* coincidences close in the order they start */
+    this->report_seconds(this->window_start_ns / COINCIDENCE_NS_PER_SECOND);
+    this->current_found++;
+    this->window_open = false;
+
+    return true;
+}
+
+/**
+ * \brief   Reports a reading for every second before end_second
+ */
+void CoincidenceStats::report_seconds(unsigned long long end_second)
+{
+    while (this->merged_any && (this->current_second < end_second))
+    {
+        this->c_stats.count_stats_update(this->current_found);
+        this->current_found = 0;
+        this->current_second++;
+    }
+}
@@ -0,0 +1,98 @@
+/*************************************************
+* \file      coincidenceStats.hpp
+* \details   counts coincidences, events seen on two or more
+*            detectors within a time window of each other.
+*************************************************/
+#pragma once
+
+/****************** Includes ************************/
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include "countStats.hpp"
+
+/****************** Defines *************************/
+/* detectors in a coincidence are tracked as bits of an unsigned int */
+#define COINCIDENCE_MAX_DETECTORS      32
+#define COINCIDENCE_DEFAULT_BUFFER     4096
+#define COINCIDENCE_NS_PER_SECOND      1000000000ULL
+
+/****************** Structs and Typedefs ************/
+/* Bounded queue of one detector's event times, oldest first */
+typedef struct DetectorBuffer
+{
+    std::vector<unsigned long long> times_ns;   /* size is a power of 2 */
+    size_t                          head;
+    size_t                          tail;
+
+    /* no event earlier than this will be pushed again */
+    unsigned long long              watermark_ns;
+} DetectorBuffer;
+
+/* Merged event that could still start a coincidence */
+typedef struct WindowEvent
+{
+    unsigned long long time_ns;
+    unsigned int       detector;
+} WindowEvent;
+
+/****************** Class Definition ************/
+/* Each detector pushes its own event times in time order. process() merges
+   the streams up to the point every detector has reached (its watermark).
+   Every merged event can start a window: the window slides forward to the
+   oldest event within window_ns of the newest, and as soon as it holds
+   events from min_detectors different detectors it is a coincidence. The
+   coincidence then takes every event up to window_ns after its first and
+   is only counted once an event (or a watermark) past that shows nothing
+   else can join. An event is part of at most one coincidence.
+   With only a handful of detectors, picking the oldest head by a linear
+   scan beats a heap.
+   Coincidences are binned by the second of event time their first event
+   is in, and every completed second is one reading of coincidence_stats(),
+   so its min/max cps are real per second rates however often process()
+   is called. A second is complete once the merge has moved past anywhere
+   a coincidence in it could still start. A long gap in the events is
+   reported as a 0 reading for each second of it. Readings are stamped with
+   the wall time they are reported at, like any other channel.
+   Not thread safe, push and process from the acquisition thread. */
+class CoincidenceStats
+{
+   public:
+      CoincidenceStats(unsigned int num_detectors, unsigned long long window_ns,
+                       unsigned int min_detectors = 2,
+                       size_t buffer_events = COINCIDENCE_DEFAULT_BUFFER);
+
+      bool coincidence_push(unsigned int detector, unsigned long long time_ns);
+      void coincidence_advance(unsigned int detector, unsigned long long time_ns);
+      unsigned int coincidence_process();
+      unsigned int coincidence_flush();
+
+      /* Coincidences found, one reading per second of event time */
+      CountStats &coincidence_stats();
+
+   private:
+      unsigned int merge(unsigned long long safe_ns);
+      bool close_window();
+      void report_seconds(unsigned long long end_second);
+
+      std::vector<DetectorBuffer> detectors;
+      unsigned long long          window_ns;
+      unsigned int                min_detectors;
+
+      /* events within window_ns of the newest, not a coincidence yet */
+      std::deque<WindowEvent>     candidates;
+      std::vector<unsigned int>   candidate_hits;         /* per detector */
+      unsigned int                candidate_detectors;    /* bit per detector */
+
+      /* coincidence taking events until window_ns past its first */
+      bool                        window_open;
+      unsigned long long          window_start_ns;
+
+      /* second of event time being counted, earlier ones are reported */
+      bool                        merged_any;
+      unsigned long long          last_merged_ns;
+      unsigned long long          current_second;
+      unsigned int                current_found;
+
+      CountStats                  c_stats;
+};
@@ -0,0 +1,203 @@
+/*************************************************
+* \file      countCheckpoint.cpp
+* \details   keeps a copy of count stats in a memory mapped
+*            file so they survive a restart of the process.
+*************************************************/
+
+/****************** Includes ************************/
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "countCheckpoint.hpp"
+
+using namespace std;
+
+/****************** Defines *************************/
+#define CHECKPOINT_MAGIC   0x43535450 /* "CSTP" */
+#define CHECKPOINT_VERSION 1
+
+/****************** Private Functions ***************/
+
+/**
+ * \brief   FNV-1a checksum of a record's sequence and stats
+ */
+static unsigned int record_checksum(const CheckpointRecord &record)
+{
+    const unsigned char *p_byte = (const unsigned char *)&record;
+    const unsigned char *p_end  = (const unsigned char *)&record.checksum;
+    unsigned int         hash   = 2166136261u;
+
+    while (p_byte < p_end)
+    {
+        hash = (hash ^ *p_byte++) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * \brief   Checks a record was completely written
+ */
+static bool record_valid(const CheckpointRecord &record)
+{
+    return (0 != record.sequence) && (record_checksum(record) == record.checksum);
+}
+
+/****************** Public Functions ****************/
+
+/**
+ * \brief   Create a checkpoint that is not backed by a file yet
+ */
+CountCheckpoint::CountCheckpoint(void)
+{
+    this->p_file   = NULL;
+    this->sequence = 0;
+}
+
+/**
+ * \brief   Flushes and unmaps the checkpoint file if one is open
+ */
+CountCheckpoint::~CountCheckpoint(void)
+{
+    this->count_checkpoint_close();
+}
+
+/**
+ * \brief   Opens (creating if needed) and maps a checkpoint file
+ * \details A file that is missing, the wrong size or from another
+ *          version is reinitialized with no saved stats.
+ *
+ * \param checkpoint_path - path of the checkpoint file
+ *
+ * \return bool - false if failed
+ */
+bool CountCheckpoint::count_checkpoint_open(const char *checkpoint_path)
+{
+    CheckpointFile *p_map = NULL;
+    struct stat     file_stat;
+    bool            fresh = false;
+    int             fd    = -1;
+
+    this->count_checkpoint_close();
+
+    fd = open(checkpoint_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        cerr << "failed to open checkpoint " << checkpoint_path << endl;
+        return false;
+    }
+
+    if ((0 != fstat(fd, &file_stat)) ||
+        ((size_t)file_stat.st_size != sizeof(CheckpointFile)))
+    {
+        fresh = true;
+        if ((0 != ftruncate(fd, 0)) || (0 != ftruncate(fd, sizeof(CheckpointFile))))
+        {
+            cerr << "failed to size checkpoint " << checkpoint_path << endl;
+            close(fd);
+            return false;
+        }
+    }
+
+    p_map = (CheckpointFile *)mmap(NULL, sizeof(CheckpointFile), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, fd, 0);
+    /* the mapping keeps the file open */
+    close(fd);
+
+    if (MAP_FAILED == (void *)p_map)
+    {
+        cerr << "failed to map checkpoint " << checkpoint_path << endl;
+        return false;
+    }
+
+    if (!fresh && ((CHECKPOINT_MAGIC != p_map->magic) ||
+                   (CHECKPOINT_VERSION != p_map->version) ||
+                   (sizeof(CheckpointRecord) != p_map->record_size)))
+    {
+        cerr << "checkpoint " << checkpoint_path << " is not compatible, starting over" << endl;
+        fresh = true;
+    }
+
+    if (fresh)
+    {
+        memset(p_map, 0, sizeof(CheckpointFile));
+        p_map->magic       = CHECKPOINT_MAGIC;
+        p_map->version     = CHECKPOINT_VERSION;
+        p_map->record_size = sizeof(CheckpointRecord);
+    }
+
+    for (const CheckpointRecord &record : p_map->records)
+    {
+        if (record_valid(record) && (this->sequence < record.sequence))
+        {
+            this->sequence = record.sequence;
+        }
+    }
+
+    this->p_file = p_map;
+
+    return true;
+}
+
+/**
+ * \brief   Flushes and unmaps the checkpoint file if one is open
+ * \return  void
+ */
+void CountCheckpoint::count_checkpoint_close()
+{
+    if (this->p_file)
+    {
+        msync(this->p_file, sizeof(CheckpointFile), MS_SYNC);
+        munmap(this->p_file, sizeof(CheckpointFile));
+        this->p_file = NULL;
+    }
+
+    this->sequence = 0;
+}
+
+/**
+ * \brief   Gets the newest good stats saved in the checkpoint
+ *
+ * \param load_data - reference to place stats inside of
+ *
+ * \return bool - false if not open or nothing good has been saved
+ */
+bool CountCheckpoint::count_checkpoint_load(CountData &load_data)
+{
+    if (!this->p_file || (0 == this->sequence))
+    {
+        return false;
+    }
+
+    load_data = this->p_file->records[this->sequence & 1].c_stats;
+
+    return true;
+}
+
+/**
+ * \brief   Saves stats over the older of the two records
+ * \details Writes go to the shared mapping so they survive the process
+ *          crashing, the kernel writes them back to disk on its own.
+ *          Does nothing if the checkpoint is not open.
+ *
+ * \param save_data - stats to save
+ *
+ * \return void
+ */
+void CountCheckpoint::count_checkpoint_save(const CountData &save_data)
+{
+    CheckpointRecord *p_record = NULL;
+
+    if (this->p_file)
+    {
+        this->sequence++;
+        p_record = &this->p_file->records[this->sequence & 1];
+
+        p_record->sequence = this->sequence;
+        p_record->c_stats  = save_data;
+        p_record->checksum = record_checksum(*p_record);
+    }
+}
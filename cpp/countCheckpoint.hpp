@@ -0,0 +1,54 @@
+/*************************************************
+* \file      countCheckpoint.hpp
+* \details   keeps a copy of count stats in a memory mapped
+*            file so they survive a restart of the process.
+*************************************************/
+#pragma once
+
+/****************** Includes ************************/
+#include "countData.hpp"
+
+/****************** Structs and Typedefs ************/
+/* One copy of the stats. The checksum covers sequence and stats so a
+   record torn by a crash part way through a save is never loaded. */
+typedef struct CheckpointRecord
+{
+    unsigned long long sequence;
+    CountData          c_stats;
+    unsigned int       checksum;
+} CheckpointRecord;
+
+/* Layout of the file. Saves alternate between the two records so the
+   previous good copy is never the one being written. */
+typedef struct CheckpointFile
+{
+    unsigned int     magic;
+    unsigned int     version;
+    unsigned int     record_size;
+    CheckpointRecord records[2];
+} CheckpointFile;
+
+/****************** Class Definition ************/
+/* Does nothing until opened, so it can be a member of every CountStats.
+   Not thread safe, the owner is expected to lock around saves. */
+class CountCheckpoint
+{
+   public:
+      CountCheckpoint(void);
+      ~CountCheckpoint(void);
+
+      /* owns a mapping, copying would unmap it twice */
+      CountCheckpoint(const CountCheckpoint &) = delete;
+      CountCheckpoint &operator=(const CountCheckpoint &) = delete;
+
+      bool count_checkpoint_open(const char *checkpoint_path);
+      void count_checkpoint_close();
+      bool count_checkpoint_load(CountData &load_data);
+      void count_checkpoint_save(const CountData &save_data);
+
+   private:
+      CheckpointFile    *p_file;
+
+      /* sequence of the newest good record, 0 if there is none */
+      unsigned long long sequence;
+};
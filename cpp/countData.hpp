@@ -0,0 +1,33 @@
+/*************************************************
+* \file      countData.hpp
+* \details   stats structure shared by countStats and the
+*            objects that hang off of it.
+*************************************************/
+#pragma once
+
+/****************** Includes ************************/
+#include <time.h>
+
+/****************** Structs and Typedefs ************/
+/* Public Structure to return stats back to user in */
+/* All stats will be considered invalid until first reading is recieved.  If you
+   were to consider the values of 0 to be valid it wouldn't make sense on a graph
+   as you actually don't know the value before you started measurring. */
+typedef struct CountData
+{
+    unsigned int total_counts; /* Can numbers of readings be so high that this could overflow? */
+    unsigned int number_of_readings;
+    
+    /* min/max cps are instantaneous and not a moving average over a long period of time */
+    /* min_cps will always be inited on first update otherwise min would always be 0 */
+    unsigned int min_cps;
+    unsigned int max_cps;
+    
+    /* User will be responsible for converting too a human readable time */
+    /* As updates and requests are only expected every second, using
+       anything more granular than sec is probably not needed. Depends
+       on what user interface looks like and how granular time will be displayed */
+    time_t first_epoch_time_seconds;
+    time_t last_epoch_time_seconds;
+     
+} CountData;
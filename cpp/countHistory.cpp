@@ -0,0 +1,654 @@
+/*************************************************
+* \file      countHistory.cpp
+* \details   compressed in memory history of the readings
+*            reported to a countStats object.
+*************************************************/
+
+/****************** Includes ************************/
+#include <cstring>
+#include <climits>
+#include "countHistory.hpp"
+
+using namespace std;
+
+/****************** Private Functions ***************/
+
+/**
+ * \brief   Maps a signed value to unsigned so small negatives stay small
+ */
+static inline unsigned long long zigzag_encode(long long value)
+{
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+/**
+ * \brief   Undoes zigzag_encode
+ */
+static inline long long zigzag_decode(unsigned long long value)
+{
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+/**
+ * \brief   Writes a varint (7 bits per byte, high bit set if more follow)
+ * \return  unsigned char* - position after the written bytes
+ */
+static inline unsigned char *varint_write(unsigned char *p_out, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        *p_out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p_out++ = (unsigned char)value;
+
+    return p_out;
+}
+
+/**
+ * \brief   Reads a varint written by varint_write
+ * \return  const unsigned char* - position after the read bytes
+ */
+static inline const unsigned char *varint_read(const unsigned char *p_in, unsigned long long &value)
+{
+    unsigned int shift = 0;
+
+    value = 0;
+    while (*p_in & 0x80)
+    {
+        value |= (unsigned long long)(*p_in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (unsigned long long)*p_in++ << shift;
+
+    return p_in;
+}
+
+/**
+ * \brief   Adds a single reading to range stats
+ * \details range_data is empty while its first epoch time is 0,
+ *          same as the rest of the lib.
+ */
+static void add_sample(CountData &range_data, time_t epoch_time_seconds, unsigned int count)
+{
+    if (0 == range_data.first_epoch_time_seconds)
+    {
+        range_data.first_epoch_time_seconds = epoch_time_seconds;
+        range_data.min_cps = count;
+        range_data.max_cps = count;
+    }
+    else if (count < range_data.min_cps)
+    {
+        range_data.min_cps = count;
+    }
+    else if (range_data.max_cps < count)
+    {
+        range_data.max_cps = count;
+    }
+
+    range_data.last_epoch_time_seconds = epoch_time_seconds;
+    range_data.total_counts += count;
+    range_data.number_of_readings++;
+}
+
+/**
+ * \brief   Adds a run of readings to range stats using only their summary
+ */
+static void add_node(CountData &range_data, const HistoryNode &node,
+                     time_t first_epoch_time_seconds, time_t last_epoch_time_seconds)
+{
+    if (0 == range_data.first_epoch_time_seconds)
+    {
+        range_data.first_epoch_time_seconds = first_epoch_time_seconds;
+        range_data.min_cps = node.min_cps;
+        range_data.max_cps = node.max_cps;
+    }
+    else
+    {
+        if (node.min_cps < range_data.min_cps)
+        {
+            range_data.min_cps = node.min_cps;
+        }
+        if (range_data.max_cps < node.max_cps)
+        {
+            range_data.max_cps = node.max_cps;
+        }
+    }
+
+    range_data.last_epoch_time_seconds = last_epoch_time_seconds;
+    range_data.total_counts += (unsigned int)node.total_counts;
+    range_data.number_of_readings += node.number_of_readings;
+}
+
+/**
+ * \brief   Summary of a block taken from its header
+ */
+static HistoryNode header_node(const HistoryBlockHeader &header)
+{
+    HistoryNode node;
+
+    node.total_counts       = header.total_counts;
+    node.number_of_readings = header.number_of_readings;
+    node.min_cps            = header.min_cps;
+    node.max_cps            = header.max_cps;
+
+    return node;
+}
+
+/**
+ * \brief   Summary of no readings, combining with it changes nothing
+ */
+static HistoryNode empty_node()
+{
+    HistoryNode node;
+
+    node.total_counts       = 0;
+    node.number_of_readings = 0;
+    node.min_cps            = UINT_MAX;
+    node.max_cps            = 0;
+
+    return node;
+}
+
+/**
+ * \brief   Summary of two runs of readings
+ */
+static HistoryNode combine_nodes(const HistoryNode &left, const HistoryNode &right)
+{
+    HistoryNode node;
+
+    node.total_counts       = left.total_counts + right.total_counts;
+    node.number_of_readings = left.number_of_readings + right.number_of_readings;
+    node.min_cps            = (right.min_cps < left.min_cps) ? right.min_cps : left.min_cps;
+    node.max_cps            = (left.max_cps < right.max_cps) ? right.max_cps : left.max_cps;
+
+    return node;
+}
+
+/****************** Public Functions ****************/
+
+/**
+ * \brief   Create an empty history
+ * \details Blocks are only allocated as readings come in, a chunk at a
+ *          time, so a history that is barely used stays small.
+ *
+ * \param max_blocks - number of blocks kept before the oldest is dropped
+ *
+ */
+CountHistory::CountHistory(size_t max_blocks)
+{
+    /* need at least the open block */
+    this->max_blocks = max_blocks ? max_blocks : 1;
+    this->blocks.reserve(this->max_blocks);
+
+    /* a level per power of 2 up to one node covering every slot */
+    for (size_t span = 1; ; span *= 2)
+    {
+        this->tree.push_back(HistoryLevel());
+        this->tree.back().reserve((this->max_blocks + span - 1) / span);
+
+        if (this->max_blocks <= span)
+        {
+            break;
+        }
+    }
+
+    this->clear();
+}
+
+/**
+ * \brief   Drops every stored reading
+ * \return  void
+ */
+void CountHistory::clear()
+{
+    this->blocks.clear();
+    this->oldest_block_seq = 0;
+    this->next_block_seq   = 0;
+    this->samples          = 0;
+    for (HistoryLevel &level : this->tree)
+    {
+        level.clear();
+    }
+    this->prev_time        = 0;
+    this->prev_delta       = 0;
+    this->prev_count       = 0;
+}
+
+/**
+ * \brief   Adds a reading to the history
+ * \details Readings are expected in time order. A time older than the
+ *          previous reading (clock stepped back) is stored as the previous
+ *          time so blocks stay sorted for queries.
+ *
+ * \param epoch_time_seconds - time the reading was taken
+ * \param count              - number of counts in the reading
+ *
+ * \return void
+ */
+void CountHistory::append(time_t epoch_time_seconds, unsigned int count)
+{
+    HistoryBlock       *p_block = NULL;
+    unsigned char      *p_out   = NULL;
+    unsigned long long  code    = 0;
+    long long           delta   = 0;
+    long long           dod     = 0;
+
+    if (0 == this->samples)
+    {
+        this->open_block(epoch_time_seconds, count);
+        return;
+    }
+
+    if (epoch_time_seconds < this->prev_time)
+    {
+        epoch_time_seconds = this->prev_time;
+    }
+
+    p_block = &this->block_at(this->next_block_seq - 1);
+
+    if (COUNT_HISTORY_BLOCK_BYTES - p_block->header.used_bytes < COUNT_HISTORY_MAX_SAMPLE_BYTES)
+    {
+        this->open_block(epoch_time_seconds, count);
+        return;
+    }
+
+    delta = (long long)(epoch_time_seconds - this->prev_time);
+    dod   = delta - this->prev_delta;
+
+    /* low bit flags that a time delta of delta follows the count delta */
+    code  = zigzag_encode((long long)count - (long long)this->prev_count) << 1;
+    p_out = p_block->payload + p_block->header.used_bytes;
+
+    if (0 == dod)
+    {
+        p_out = varint_write(p_out, code);
+    }
+    else
+    {
+        p_out = varint_write(p_out, code | 1);
+        p_out = varint_write(p_out, zigzag_encode(dod));
+    }
+
+    p_block->header.used_bytes = (unsigned short)(p_out - p_block->payload);
+    p_block->header.last_epoch_time_seconds = epoch_time_seconds;
+    p_block->header.total_counts += count;
+    p_block->header.number_of_readings++;
+
+    if (count < p_block->header.min_cps)
+    {
+        p_block->header.min_cps = count;
+    }
+    else if (p_block->header.max_cps < count)
+    {
+        p_block->header.max_cps = count;
+    }
+
+    this->prev_time  = epoch_time_seconds;
+    this->prev_delta = delta;
+    this->prev_count = count;
+    this->samples++;
+}
+
+/**
+ * \brief   Gets stats for the readings taken between two times
+ * \details Closed blocks entirely inside the range come from the segment
+ *          tree, only the blocks the range starts or ends in are decompressed.
+ *          O(log n) in the number of blocks stored.
+ *
+ * \param start_time - first time to include
+ * \param end_time   - last time to include
+ * \param range_data - reference to place stats inside of
+ *
+ * \return bool - false if no readings were taken in the range
+ */
+bool CountHistory::query(time_t start_time, time_t end_time, CountData &range_data) const
+{
+    unsigned long long first_seq   = 0;
+    unsigned long long end_seq     = 0;
+    unsigned long long full_first  = 0;
+    unsigned long long full_end    = 0;
+    bool               decode_last = false;
+    bool               open_in_run = false;
+    HistoryNode        node        = empty_node();
+
+    memset(&range_data, 0, sizeof(CountData));
+
+    if ((0 == this->samples) || (end_time < start_time))
+    {
+        return false;
+    }
+
+    /* blocks [first_seq, end_seq) hold readings inside the range */
+    first_seq = this->first_block_ending_after(start_time);
+    end_seq   = this->first_block_starting_after(end_time);
+
+    if (end_seq <= first_seq)
+    {
+        return false;
+    }
+
+    full_first = first_seq;
+    full_end   = end_seq;
+
+    if (this->block_at(first_seq).header.first_epoch_time_seconds < start_time)
+    {
+        this->decode_block(this->block_at(first_seq), start_time, end_time, range_data);
+        full_first++;
+    }
+
+    if ((full_first < full_end) &&
+        (end_time < this->block_at(end_seq - 1).header.last_epoch_time_seconds))
+    {
+        decode_last = true;
+        full_end--;
+    }
+
+    /* the open block is not in the tree yet, its header is always current */
+    if ((full_first < full_end) && (full_end == this->next_block_seq))
+    {
+        open_in_run = true;
+        full_end--;
+    }
+
+    if (full_first < full_end)
+    {
+        size_t first_slot = full_first % this->max_blocks;
+        size_t last_slot  = (full_end - 1) % this->max_blocks;
+
+        if (first_slot <= last_slot)
+        {
+            this->tree_query(first_slot, last_slot, node);
+        }
+        else
+        {
+            this->tree_query(first_slot, this->max_blocks - 1, node);
+            this->tree_query(0, last_slot, node);
+        }
+
+        add_node(range_data, node,
+                 this->block_at(full_first).header.first_epoch_time_seconds,
+                 this->block_at(full_end - 1).header.last_epoch_time_seconds);
+    }
+
+    if (open_in_run)
+    {
+        const HistoryBlockHeader &header = this->block_at(this->next_block_seq - 1).header;
+
+        add_node(range_data, header_node(header),
+                 header.first_epoch_time_seconds, header.last_epoch_time_seconds);
+    }
+
+    if (decode_last)
+    {
+        this->decode_block(this->block_at(end_seq - 1), start_time, end_time, range_data);
+    }
+
+    return (0 != range_data.first_epoch_time_seconds);
+}
+
+/**
+ * \brief   Number of readings currently stored
+ */
+size_t CountHistory::number_of_samples() const
+{
+    return this->samples;
+}
+
+/**
+ * \brief   Memory held by the stored readings and their index
+ * \details Every allocated block takes its full size, header and whole
+ *          payload, whether or not it is in use yet. The segment tree
+ *          nodes allocated are counted too.
+ */
+size_t CountHistory::compressed_bytes() const
+{
+    size_t bytes = this->blocks.capacity() * sizeof(HistoryBlock);
+
+    for (const HistoryLevel &level : this->tree)
+    {
+        bytes += level.capacity() * sizeof(HistoryNode);
+    }
+
+    return bytes;
+}
+
+/****************** Private Methods *****************/
+
+HistoryBlock &CountHistory::block_at(unsigned long long block_seq)
+{
+    return this->blocks[block_seq % this->max_blocks];
+}
+
+const HistoryBlock &CountHistory::block_at(unsigned long long block_seq) const
+{
+    return this->blocks[block_seq % this->max_blocks];
+}
+
+/**
+ * \brief   Starts a new block with a reading, dropping the oldest
+ *          block if the history is full.
+ * \return  void
+ */
+void CountHistory::open_block(time_t epoch_time_seconds, unsigned int count)
+{
+    HistoryBlock *p_block = NULL;
+
+    /* the block being closed is final, add it to the tree */
+    if (this->oldest_block_seq < this->next_block_seq)
+    {
+        this->tree_set((this->next_block_seq - 1) % this->max_blocks,
+                       &this->block_at(this->next_block_seq - 1).header);
+    }
+
+    if (this->next_block_seq - this->oldest_block_seq == this->max_blocks)
+    {
+        this->samples -= this->block_at(this->oldest_block_seq).header.number_of_readings;
+        this->tree_set(this->oldest_block_seq % this->max_blocks, NULL);
+        this->oldest_block_seq++;
+    }
+
+    /* slots fill in order while the ring is filling */
+    if (this->next_block_seq % this->max_blocks == this->blocks.capacity())
+    {
+        this->blocks.add_chunk();
+    }
+
+    p_block = &this->block_at(this->next_block_seq);
+    this->next_block_seq++;
+
+    p_block->header.first_epoch_time_seconds = epoch_time_seconds;
+    p_block->header.last_epoch_time_seconds  = epoch_time_seconds;
+    p_block->header.first_count              = count;
+    p_block->header.min_cps                  = count;
+    p_block->header.max_cps                  = count;
+    p_block->header.number_of_readings       = 1;
+    p_block->header.total_counts             = count;
+    p_block->header.used_bytes               = 0;
+
+    /* each block decodes on its own, deltas restart at 0 */
+    this->prev_time  = epoch_time_seconds;
+    this->prev_delta = 0;
+    this->prev_count = count;
+    this->samples++;
+}
+
+/**
+ * \brief   Decompresses a block, adding the readings between two times
+ *          to range stats.
+ * \return  void
+ */
+void CountHistory::decode_block(const HistoryBlock &block, time_t start_time, time_t end_time,
+                                CountData &range_data) const
+{
+    const unsigned char *p_in    = block.payload;
+    const unsigned char *p_end   = block.payload + block.header.used_bytes;
+    unsigned long long   code    = 0;
+    unsigned long long   dod     = 0;
+    time_t               time    = block.header.first_epoch_time_seconds;
+    long long            delta   = 0;
+    unsigned int         count   = block.header.first_count;
+
+    if (start_time <= time)
+    {
+        add_sample(range_data, time, count);
+    }
+
+    while (p_in < p_end)
+    {
+        p_in = varint_read(p_in, code);
+        if (code & 1)
+        {
+            p_in = varint_read(p_in, dod);
+            delta += zigzag_decode(dod);
+        }
+
+        time  += (time_t)delta;
+        count  = (unsigned int)((long long)count + zigzag_decode(code >> 1));
+
+        if (end_time < time)
+        {
+            break;
+        }
+        if (start_time <= time)
+        {
+            add_sample(range_data, time, count);
+        }
+    }
+}
+
+/**
+ * \brief   First block whose last reading is at or after a time
+ * \return  unsigned long long - block sequence, next_block_seq if none
+ */
+unsigned long long CountHistory::first_block_ending_after(time_t epoch_time_seconds) const
+{
+    unsigned long long low  = this->oldest_block_seq;
+    unsigned long long high = this->next_block_seq;
+    unsigned long long mid  = 0;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (this->block_at(mid).header.last_epoch_time_seconds < epoch_time_seconds)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * \brief   First block whose first reading is after a time
+ * \return  unsigned long long - block sequence, next_block_seq if none
+ */
+unsigned long long CountHistory::first_block_starting_after(time_t epoch_time_seconds) const
+{
+    unsigned long long low  = this->oldest_block_seq;
+    unsigned long long high = this->next_block_seq;
+    unsigned long long mid  = 0;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (this->block_at(mid).header.first_epoch_time_seconds <= epoch_time_seconds)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * \brief   Sets the tree leaf for a block slot and updates its parents
+ *
+ * \param slot     - block slot (sequence % max_blocks)
+ * \param p_header - header of the closed block, NULL to empty the slot
+ *
+ * \return  void
+ */
+void CountHistory::tree_set(size_t slot, const HistoryBlockHeader *p_header)
+{
+    size_t index = slot;
+    size_t level = 0;
+    size_t i     = 0;
+
+    for (level = 0; level < this->tree.size(); level++, index /= 2)
+    {
+        HistoryLevel &nodes = this->tree[level];
+
+        /* slots fill in order, so this adds at most one chunk */
+        while (nodes.capacity() <= index)
+        {
+            i = nodes.capacity();
+            nodes.add_chunk();
+            for (; i < nodes.capacity(); i++)
+            {
+                nodes[i] = empty_node();
+            }
+        }
+
+        if (0 == level)
+        {
+            nodes[index] = p_header ? header_node(*p_header) : empty_node();
+        }
+        else
+        {
+            nodes[index] = combine_nodes(this->tree_node(level - 1, 2 * index),
+                                         this->tree_node(level - 1, 2 * index + 1));
+        }
+    }
+}
+
+/**
+ * \brief   Summary held by a tree node, empty if it was never set
+ */
+HistoryNode CountHistory::tree_node(size_t level, size_t index) const
+{
+    if (this->tree[level].capacity() <= index)
+    {
+        return empty_node();
+    }
+
+    return this->tree[level][index];
+}
+
+/**
+ * \brief   Combines the summaries of a run of block slots into node
+ *
+ * \param first_slot - first slot to include
+ * \param last_slot  - last slot to include
+ * \param node       - summary to combine the slots into
+ *
+ * \return  void
+ */
+void CountHistory::tree_query(size_t first_slot, size_t last_slot, HistoryNode &node) const
+{
+    size_t low   = first_slot;
+    size_t high  = last_slot + 1;
+    size_t level = 0;
+
+    for (level = 0; low < high; level++)
+    {
+        if (low & 1)
+        {
+            node = combine_nodes(node, this->tree_node(level, low++));
+        }
+        if (high & 1)
+        {
+            node = combine_nodes(node, this->tree_node(level, --high));
+        }
+        low  /= 2;
+        high /= 2;
+    }
+}
@@ -0,0 +1,161 @@
+/*************************************************
+* \file      countHistory.hpp
+* \details   compressed in memory history of the readings
+*            reported to a countStats object.
+*************************************************/
+#pragma once
+
+/****************** Includes ************************/
+#include <time.h>
+#include <stddef.h>
+#include <vector>
+#include "countData.hpp"
+
+/****************** Defines *************************/
+/* Size of the compressed payload of a block. With readings once a second
+   most samples encode to a single byte, so a block holds a few minutes. */
+#define COUNT_HISTORY_BLOCK_BYTES        240
+
+/* Worst case size of one encoded sample (5 byte count varint + 10 byte
+   time varint). A block is closed once less than this is left. */
+#define COUNT_HISTORY_MAX_SAMPLE_BYTES   16
+
+/* Roughly 4 weeks of once a second readings */
+#define COUNT_HISTORY_DEFAULT_MAX_BLOCKS 16384
+
+/* Blocks are allocated this many at a time (about 18KB) */
+#define COUNT_HISTORY_CHUNK_BLOCKS       64
+
+/* Segment tree nodes are allocated this many at a time, per tree level */
+#define COUNT_HISTORY_CHUNK_NODES        64
+
+/****************** Structs and Typedefs ************/
+/* Summary of every sample stored in a block. Range queries that cover a
+   whole block are answered from this without decompressing the payload. */
+typedef struct HistoryBlockHeader
+{
+    time_t first_epoch_time_seconds;
+    time_t last_epoch_time_seconds;
+
+    /* first sample is stored raw, the payload only holds samples after it */
+    unsigned int first_count;
+    unsigned int min_cps;
+    unsigned int max_cps;
+    unsigned int number_of_readings;
+    unsigned long long total_counts;
+
+    unsigned short used_bytes;
+} HistoryBlockHeader;
+
+/* Node of the segment tree built over closed blocks */
+typedef struct HistoryNode
+{
+    unsigned long long total_counts;
+    unsigned int       number_of_readings;
+    unsigned int       min_cps;
+    unsigned int       max_cps;
+} HistoryNode;
+
+typedef struct HistoryBlock
+{
+    HistoryBlockHeader header;
+    unsigned char      payload[COUNT_HISTORY_BLOCK_BYTES];
+} HistoryBlock;
+
+/****************** Class Definition ************/
+/* Array that grows a fixed size chunk at a time. Growing never moves or
+   copies what is already stored, so it is safe to do under stats_lock. */
+template <typename T, size_t CHUNK_SIZE>
+class HistoryChunks
+{
+   public:
+      /* sizes the list of chunks so adding one never reallocates it */
+      void reserve(size_t max_elements)
+      {
+         this->chunks.reserve((max_elements + CHUNK_SIZE - 1) / CHUNK_SIZE);
+      }
+
+      void add_chunk()
+      {
+         this->chunks.emplace_back(CHUNK_SIZE);
+      }
+
+      void clear()
+      {
+         this->chunks.clear();
+      }
+
+      size_t capacity() const
+      {
+         return this->chunks.size() * CHUNK_SIZE;
+      }
+
+      T &operator[](size_t index)
+      {
+         return this->chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+      }
+
+      const T &operator[](size_t index) const
+      {
+         return this->chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+      }
+
+   private:
+      /* each chunk is sized once and never grows */
+      std::vector<std::vector<T>> chunks;
+};
+
+/* One level of the segment tree over closed blocks */
+typedef HistoryChunks<HistoryNode, COUNT_HISTORY_CHUNK_NODES> HistoryLevel;
+
+/* Keeps every reading as a (time, count) pair packed into fixed size blocks.
+   Times are stored as zigzag varint delta of deltas and counts as zigzag
+   varint deltas from the previous count, with the "delta of delta is 0" case
+   folded into the low bit of the count so steady once a second readings take
+   1 byte each. Once max_blocks are full the oldest block is dropped.
+   Closed blocks are summarized in a segment tree so a range query costs a
+   binary search, an O(log n) tree walk and decoding at most the two blocks
+   at the ends of the range. The tree only changes when a block closes, a
+   walk up from its leaf. Blocks and tree nodes are allocated in fixed
+   chunks as they are needed, so an append never moves what is stored.
+   Not thread safe, the owner is expected to lock around it. */
+class CountHistory
+{
+   public:
+      CountHistory(size_t max_blocks = COUNT_HISTORY_DEFAULT_MAX_BLOCKS);
+
+      void append(time_t epoch_time_seconds, unsigned int count);
+      bool query(time_t start_time, time_t end_time, CountData &range_data) const;
+      void clear();
+
+      size_t number_of_samples() const;
+      size_t compressed_bytes() const;
+
+   private:
+      HistoryBlock       &block_at(unsigned long long block_seq);
+      const HistoryBlock &block_at(unsigned long long block_seq) const;
+      void open_block(time_t epoch_time_seconds, unsigned int count);
+      void decode_block(const HistoryBlock &block, time_t start_time, time_t end_time,
+                        CountData &range_data) const;
+      unsigned long long first_block_ending_after(time_t epoch_time_seconds) const;
+      unsigned long long first_block_starting_after(time_t epoch_time_seconds) const;
+      void tree_set(size_t slot, const HistoryBlockHeader *p_header);
+      HistoryNode tree_node(size_t level, size_t index) const;
+      void tree_query(size_t first_slot, size_t last_slot, HistoryNode &node) const;
+
+      /* ring of blocks, indexed by block sequence number % max_blocks */
+      HistoryChunks<HistoryBlock, COUNT_HISTORY_CHUNK_BLOCKS> blocks;
+      size_t                    max_blocks;
+      unsigned long long        oldest_block_seq;
+      unsigned long long        next_block_seq;
+      size_t                    samples;
+
+      /* segment tree over closed block slots, leaf i is tree[0][i] and
+         tree[level][i] covers slots i << level to ((i + 1) << level) - 1 */
+      std::vector<HistoryLevel> tree;
+
+      /* encoder state for the newest (open) block */
+      time_t       prev_time;
+      long long    prev_delta;
+      unsigned int prev_count;
+};
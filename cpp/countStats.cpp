@@ -10,18 +10,131 @@
 /****************** Includes ************************/
 #include <iostream>
 #include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
 #include "countStats.hpp"
 
 using namespace std;
+/****************** Private Functions ***************/
+
+/**
+ * \brief   Seconds on CLOCK_MONOTONIC, which wall clock steps do not move
+ */
+static time_t monotonic_seconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+/**
+ * \brief   Closes the fds of a subscriber
+ */
+static void subscriber_close(CountSubscriber &subscriber)
+{
+    if (subscriber.poll_fd >= 0)
+    {
+        close(subscriber.poll_fd);
+    }
+    if (subscriber.timer_fd >= 0)
+    {
+        close(subscriber.timer_fd);
+    }
+    if (subscriber.event_fd >= 0)
+    {
+        close(subscriber.event_fd);
+    }
+
+    subscriber.poll_fd  = -1;
+    subscriber.timer_fd = -1;
+    subscriber.event_fd = -1;
+}
+
+/**
+ * \brief   Creates the fds for a subscriber
+ * \return  bool - false if failed, no fds are left open
+ */
+static bool subscriber_open(CountSubscriber &subscriber)
+{
+    struct epoll_event event = {0};
+
+    event.events = EPOLLIN;
+
+    subscriber.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    subscriber.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    subscriber.poll_fd  = epoll_create1(EPOLL_CLOEXEC);
+
+    if ((subscriber.event_fd < 0) || (subscriber.timer_fd < 0) || (subscriber.poll_fd < 0) ||
+        (0 != epoll_ctl(subscriber.poll_fd, EPOLL_CTL_ADD, subscriber.event_fd, &event)) ||
+        (0 != epoll_ctl(subscriber.poll_fd, EPOLL_CTL_ADD, subscriber.timer_fd, &event)))
+    {
+        subscriber_close(subscriber);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * \brief   Wakes a subscriber now, cancelling any held back wakeup
+ */
+static void subscriber_wake(CountSubscriber &subscriber, time_t now)
+{
+    struct itimerspec disarm = {};
+    uint64_t          wake   = 1;
+
+    if (sizeof(wake) != write(subscriber.event_fd, &wake, sizeof(wake)))
+    {
+        cerr << "failed to wake subscriber\n";
+    }
+
+    if (subscriber.timer_armed)
+    {
+        timerfd_settime(subscriber.timer_fd, 0, &disarm, NULL);
+        subscriber.timer_armed = false;
+    }
+
+    subscriber.signalled        = true;
+    subscriber.last_notify_time = now;
+}
+
+/**
+ * \brief   Wakes a subscriber when its interval ends
+ */
+static void subscriber_hold(CountSubscriber &subscriber)
+{
+    struct itimerspec expire = {};
+
+    expire.it_value.tv_sec = subscriber.last_notify_time + subscriber.min_interval_seconds;
+
+    if (0 != timerfd_settime(subscriber.timer_fd, TFD_TIMER_ABSTIME, &expire, NULL))
+    {
+        cerr << "failed to arm subscriber timer\n";
+    }
+    else
+    {
+        subscriber.timer_armed = true;
+    }
+}
+
 /****************** Public Functions ****************/
 
 /**
  * \brief   Create a new Count Stats object 
  * \details Stats are considered invalid until first time
- *          data is recieved after creation.
+ *          data is recieved after creation, unless a checkpoint
+ *          holds stats saved by an earlier run.
+ * 
+ * \param checkpoint_path - file to keep the stats in, NULL for none
+ * 
  * \author  Jason Neitzert
  */
-CountStats::CountStats(void)
+CountStats::CountStats(const char *checkpoint_path)
 {
     /* could add a try/catch block here */
     if (0 != pthread_mutex_init(&this->stats_lock, NULL))
@@ -29,7 +142,20 @@ CountStats::CountStats(void)
         cerr << "failed to init mutex\n";      
     }
 
-    this->count_stats_reset();
+    memset(&this->c_stats, 0, sizeof(CountData));
+
+    if (checkpoint_path)
+    {
+        if (!this->c_checkpoint.count_checkpoint_open(checkpoint_path))
+        {
+            cerr << "failed to open checkpoint, stats will not be kept\n";
+        }
+        else
+        {
+            /* maps straight back in, nothing to rebuild */
+            this->c_checkpoint.count_checkpoint_load(this->c_stats);
+        }
+    }
 }
 
 /**
@@ -40,6 +166,11 @@ CountStats::CountStats(void)
 CountStats::~CountStats(void)
 {
     pthread_mutex_destroy(&this->stats_lock);
+
+    for (CountSubscriber &subscriber : this->subscribers)
+    {
+        subscriber_close(subscriber);
+    }
 }
 
 /**
@@ -55,7 +186,9 @@ void CountStats::count_stats_reset()
 {
     pthread_mutex_lock(&this->stats_lock);
     /* A zero epoch time will be considered as stats are invalid */
-    memset(&this->c_stats, 0, sizeof(CountStats));
+    memset(&this->c_stats, 0, sizeof(CountData));
+    this->c_checkpoint.count_checkpoint_save(this->c_stats);
+    this->notify_subscribers(0, monotonic_seconds(), true);
     pthread_mutex_unlock(&this->stats_lock);
 }
 
@@ -129,7 +262,239 @@ void CountStats::count_stats_update(unsigned int count)
     {
         p_data->max_cps = count;
     }
+
+    this->c_history.append(p_data->last_epoch_time_seconds, count);
+    this->c_checkpoint.count_checkpoint_save(*p_data);
+    this->notify_subscribers(count, monotonic_seconds(), false);
+    pthread_mutex_unlock(&this->stats_lock);
+}
+
+/**
+ * \brief   Gets the current stats and resets them as one step
+ * \details For per period reporting. Both happen under one hold of
+ *          stats_lock, so no update can land between the get and the
+ *          reset and lose its counts. Updates wait for the copy and
+ *          clear, same as they wait for count_stats_get.
+ * 
+ * \param get_stats - reference to place the stats of the period inside of
+ * 
+ * \return bool - false if no readings were recieved in the period
+ */
+bool CountStats::count_stats_get_and_reset(CountData &get_stats)
+{
+    bool retval = false;
+
+    pthread_mutex_lock(&this->stats_lock);
+
+    if (0 != this->c_stats.first_epoch_time_seconds)
+    {
+        get_stats = this->c_stats;
+        retval = true;
+    }
+
+    /* A zero epoch time will be considered as stats are invalid */
+    memset(&this->c_stats, 0, sizeof(CountData));
+    this->c_checkpoint.count_checkpoint_save(this->c_stats);
+    this->notify_subscribers(0, monotonic_seconds(), true);
+    pthread_mutex_unlock(&this->stats_lock);
+
+    return retval;
+}
+
+/**
+ * \brief   Gets stats for only the readings recieved between two times
+ * \details Uses the reading history, so unlike count_stats_get this is not
+ *          affected by count_stats_reset. O(log n) in the length of the history.
+ * 
+ * \param start_time - first epoch time to include
+ * \param end_time   - last epoch time to include
+ * \param range_data - reference to place stats inside of
+ * 
+ * \return bool - false if no readings were recieved in the range
+ */
+bool CountStats::count_stats_query_range(time_t start_time, time_t end_time, CountData &range_data)
+{
+    bool retval = false;
+
+    pthread_mutex_lock(&this->stats_lock);
+    retval = this->c_history.query(start_time, end_time, range_data);
+    pthread_mutex_unlock(&this->stats_lock);
+
+    return retval;
+}
+
+/**
+ * \brief   Subscribes to changes instead of polling count_stats_get
+ * \details Returns a fd that becomes readable when the stats change. Call
+ *          count_stats_ack once it is readable, then count_stats_get. Wakeups
+ *          are held back until at least count_threshold counts have come in
+ *          and min_interval_seconds have passed since the last wakeup. A
+ *          change held back by the interval wakes the subscriber when the
+ *          interval ends, even if no more updates come in. Resets,
+ *          count_stats_get_and_reset included, always wake subscribers.
+ *          Until it is acked a subscriber is not woken again, so a burst
+ *          of updates costs one wakeup.
+ * 
+ * \param min_interval_seconds - minimum time between wakeups, 0 for none
+ * \param count_threshold      - counts needed before a wakeup, 0 for any update
+ * 
+ * \return int - fd to poll on, -1 if failed
+ */
+int CountStats::count_stats_subscribe(unsigned int min_interval_seconds, unsigned int count_threshold)
+{
+    CountSubscriber subscriber = {0};
+
+    subscriber.min_interval_seconds = min_interval_seconds;
+    subscriber.count_threshold      = count_threshold;
+
+    /* the first change does not wait for an interval */
+    subscriber.last_notify_time     = monotonic_seconds() - min_interval_seconds;
+
+    if (!subscriber_open(subscriber))
+    {
+        cerr << "failed to create subscriber fds\n";
+        return -1;
+    }
+
+    pthread_mutex_lock(&this->stats_lock);
+    this->subscribers.push_back(subscriber);
     pthread_mutex_unlock(&this->stats_lock);
+
+    return subscriber.poll_fd;
+}
+
+/**
+ * \brief   Acknowledges a wakeup so the subscriber can be woken again
+ * \details Call before count_stats_get so changes made after the get
+ *          wake the subscriber again.
+ * 
+ * \param poll_fd - fd returned by count_stats_subscribe
+ * 
+ * \return bool - false if it was not subscribed
+ */
+bool CountStats::count_stats_ack(int poll_fd)
+{
+    bool     retval = false;
+    uint64_t wakes  = 0;
+
+    pthread_mutex_lock(&this->stats_lock);
+    for (CountSubscriber &subscriber : this->subscribers)
+    {
+        if (subscriber.poll_fd != poll_fd)
+        {
+            continue;
+        }
+
+        if (subscriber.signalled &&
+            (sizeof(wakes) == read(subscriber.event_fd, &wakes, sizeof(wakes))))
+        {
+            subscriber.signalled      = false;
+            subscriber.pending_counts = 0;
+        }
+
+        /* the timer going off is the held back wakeup */
+        if (subscriber.timer_armed &&
+            (sizeof(wakes) == read(subscriber.timer_fd, &wakes, sizeof(wakes))))
+        {
+            subscriber.timer_armed      = false;
+            subscriber.pending_counts   = 0;
+            subscriber.last_notify_time = monotonic_seconds();
+        }
+
+        retval = true;
+        break;
+    }
+    pthread_mutex_unlock(&this->stats_lock);
+
+    if (!retval)
+    {
+        cerr << "poll_fd is not subscribed\n";
+    }
+
+    return retval;
+}
+
+/**
+ * \brief   Removes a subscriber and closes its fds
+ * 
+ * \param poll_fd - fd returned by count_stats_subscribe
+ * 
+ * \return bool - false if it was not subscribed
+ */
+bool CountStats::count_stats_unsubscribe(int poll_fd)
+{
+    bool retval = false;
+
+    pthread_mutex_lock(&this->stats_lock);
+    for (size_t i = 0; i < this->subscribers.size(); i++)
+    {
+        if (this->subscribers[i].poll_fd == poll_fd)
+        {
+            subscriber_close(this->subscribers[i]);
+
+            /* order does not matter, move the last one into the hole */
+            this->subscribers[i] = this->subscribers.back();
+            this->subscribers.pop_back();
+            retval = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->stats_lock);
+
+    if (!retval)
+    {
+        cerr << "poll_fd is not subscribed\n";
+    }
+
+    return retval;
+}
+
+/**
+ * \brief   Wakes the subscribers whose interval and threshold have been met
+ * \details Must be called with stats_lock held. A subscriber that has
+ *          already been woken, or has a timer running, is skipped until it
+ *          acks, so most updates make no syscalls at all.
+ * 
+ * \param count - counts added by the change
+ * \param now   - CLOCK_MONOTONIC seconds of the change
+ * \param force - wake every subscriber (stats were reset)
+ * 
+ * \return void
+ */
+void CountStats::notify_subscribers(unsigned int count, time_t now, bool force)
+{
+    for (CountSubscriber &subscriber : this->subscribers)
+    {
+        if (force)
+        {
+            /* counts from before the reset are gone */
+            subscriber.pending_counts = 0;
+            if (!subscriber.signalled)
+            {
+                subscriber_wake(subscriber, now);
+            }
+            continue;
+        }
+
+        subscriber.pending_counts += count;
+
+        if (subscriber.signalled)
+        {
+            continue;
+        }
+
+        if (!subscriber.timer_armed && (subscriber.pending_counts >= subscriber.count_threshold))
+        {
+            if (now - subscriber.last_notify_time >= (time_t)subscriber.min_interval_seconds)
+            {
+                subscriber_wake(subscriber, now);
+            }
+            else
+            {
+                subscriber_hold(subscriber);
+            }
+        }
+    }
 }
 
 /**
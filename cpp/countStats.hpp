@@ -13,6 +13,10 @@
 /****************** Includes ************************/
 #include <time.h>
 #include <pthread.h>
+#include <vector>
+#include "countData.hpp"
+#include "countHistory.hpp"
+#include "countCheckpoint.hpp"
 
 /****************** Questions/Assumptions ***********/
 /*
@@ -30,28 +34,25 @@
    detail is needed other than true/false. */
 
 /****************** Structs and Typedefs ************/
-/* Public Structure to return stats back to user in */
-/* All stats will be considered invalid until first reading is recieved.  If you
-   were to consider the values of 0 to be valid it wouldn't make sense on a graph
-   as you actually don't know the value before you started measurring. */
-typedef struct CountData
+/* A consumer waiting on changes instead of polling count_stats_get */
+typedef struct CountSubscriber
 {
-    unsigned int total_counts; /* Can numbers of readings be so high that this could overflow? */
-    unsigned int number_of_readings;
-    
-    /* min/max cps are instantaneous and not a moving average over a long period of time */
-    /* min_cps will always be inited on first update otherwise min would always be 0 */
-    unsigned int min_cps;
-    unsigned int max_cps;
-    
-    /* User will be responsible for converting too a human readable time */
-    /* As updates and requests are only expected every second, using
-       anything more granular than sec is probably not needed. Depends
-       on what user interface looks like and how granular time will be displayed */
-    time_t first_epoch_time_seconds;
-    time_t last_epoch_time_seconds;
-     
-} CountData;
+    /* epoll fd handed to the subscriber, watches event_fd and timer_fd */
+    int          poll_fd;
+    int          event_fd;   /* written to wake the subscriber right away */
+    int          timer_fd;   /* wakes it when a held back interval ends */
+    unsigned int min_interval_seconds;
+    unsigned int count_threshold;
+
+    /* A wakeup is already on its way, nothing more to do until the
+       subscriber acks it. Keeps syscalls off the update path. */
+    bool         signalled;
+    bool         timer_armed;
+
+    /* changes since the last time this subscriber acked a wakeup */
+    unsigned long long pending_counts;
+    time_t             last_notify_time;   /* CLOCK_MONOTONIC seconds */
+} CountSubscriber;
 
 /****************** Class Definition ************/
 /* Assuming lib could be used by multiple
@@ -61,20 +62,42 @@ typedef struct CountData
 class CountStats
 {
    public:
-      CountStats(void);
+      /* With a checkpoint path stats are kept in that file and picked back up
+         from it the next time a CountStats is made with the same path */
+      explicit CountStats(const char *checkpoint_path = NULL);
       ~CountStats(void);
 
       void count_stats_reset();
       bool count_stats_get(CountData &get_data);
       void count_stats_update(unsigned int count);
+      bool count_stats_get_and_reset(CountData &get_data);
       /* Note: If required could add functions to get stats individually */
+
+      /* Stats for only the readings recieved between start and end time */
+      bool count_stats_query_range(time_t start_time, time_t end_time, CountData &range_data);
+
+      /* Wake a pollable fd on changes instead of polling count_stats_get */
+      int count_stats_subscribe(unsigned int min_interval_seconds, unsigned int count_threshold);
+      bool count_stats_ack(int poll_fd);
+      bool count_stats_unsubscribe(int poll_fd);
       
       /* For Testing */
       void print_stats();
 
    private:
+      void notify_subscribers(unsigned int count, time_t now, bool force);
+
       CountData c_stats;
 
+      /* Every reading since creation, not cleared by reset */
+      CountHistory c_history;
+
+      /* Only backed by a file when made with a checkpoint path */
+      CountCheckpoint c_checkpoint;
+
+      /* protected by stats_lock */
+      std::vector<CountSubscriber> subscribers;
+
       /* Using mutex to make sure I am not reading partially updated data */
       pthread_mutex_t stats_lock; 
 };
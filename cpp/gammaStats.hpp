@@ -12,5 +12,9 @@
 #include "countStats.hpp"
 
 /****************** Class Definition **************/
-class GammaStats: public CountStats{};
+class GammaStats: public CountStats
+{
+   public:
+      using CountStats::CountStats;
+};
 typedef struct CountData GammaData;
\ No newline at end of file
@@ -8,8 +8,20 @@
 
 /****************** Includes ************************/
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <atomic>
 #include "gammaStats.hpp"
+#include "coincidenceStats.hpp"
 
 using namespace std;
 
@@ -23,7 +35,7 @@ using namespace std;
  * \return void
  * \author Jason Neitzert
  */
-static void test_failure_cases_with_valid_handle(GammaStats gamma_stats)
+static void test_failure_cases_with_valid_handle(GammaStats &gamma_stats)
 {
     GammaData gdata = {0};
 
@@ -41,8 +53,10 @@ static void test_failure_cases_with_valid_handle(GammaStats gamma_stats)
  * \return void
  * \author Jason Neitzert
  */
-static void test_good_cases_with_single_thread(GammaStats gamma_stats)
+static void test_good_cases_with_single_thread(GammaStats &gamma_stats)
 {
+    GammaData history_data = {0};
+
     /* test good cases with single thread */
     gamma_stats.count_stats_update(20);
     gamma_stats.print_stats();
@@ -66,6 +80,906 @@ static void test_good_cases_with_single_thread(GammaStats gamma_stats)
 
     gamma_stats.count_stats_update(20);
     gamma_stats.print_stats();
+
+    /* history is kept across the reset */
+    if (!gamma_stats.count_stats_query_range(0, time(NULL), history_data) ||
+        (history_data.total_counts != 542) || (history_data.number_of_readings != 5))
+    {
+        cerr << "count stats history query returned wrong stats" << endl;
+    }
+}
+
+/**
+ * \brief Test compressed history against the raw readings
+ * 
+ * \return void
+ */
+static void test_history_compression()
+{
+    const time_t  start_time = 1639000000;
+    const size_t  readings   = 7 * 24 * 60 * 60;
+    CountHistory  history;
+    CountData     range_data = {0};
+    unsigned long long total = 0;
+    unsigned int  min_cps    = 0xFFFFFFFF;
+    unsigned int  max_cps    = 0;
+    unsigned int  count      = 0;
+    size_t        i          = 0;
+
+    /* a week of once a second readings with a few missed seconds */
+    for (i = 0; i < readings; i++)
+    {
+        count = 20 + (i * 7919) % 13;
+        history.append(start_time + i + (i / 1000), count);
+
+        if ((i >= 1000) && (i < 50000))
+        {
+            total += count;
+            min_cps = (count < min_cps) ? count : min_cps;
+            max_cps = (max_cps < count) ? count : max_cps;
+        }
+    }
+
+    cout << "History bytes per reading: " <<
+        (double)history.compressed_bytes() / history.number_of_samples() << endl;
+
+    if (history.number_of_samples() != readings)
+    {
+        cerr << "history lost readings" << endl;
+    }
+
+    if ((double)history.compressed_bytes() / history.number_of_samples() > 2.0)
+    {
+        cerr << "history used more than 2 bytes a reading" << endl;
+    }
+
+    /* readings 1000 - 49999, times shifted by the missed seconds */
+    if (!history.query(start_time + 1000 + 1, start_time + 49999 + 49, range_data) ||
+        (range_data.total_counts != total) || (range_data.number_of_readings != 49000) ||
+        (range_data.min_cps != min_cps) || (range_data.max_cps != max_cps))
+    {
+        cerr << "history query returned wrong stats" << endl;
+    }
+
+    if (history.query(start_time - 100, start_time - 1, range_data))
+    {
+        cerr << "history query failed to fail on empty range" << endl;
+    }
+}
+
+/**
+ * \brief Test history range queries against a brute force scan, using a
+ *        small ring so dropping old blocks is covered too. 100 blocks is
+ *        more than one chunk and not a power of 2.
+ * 
+ * \return void
+ */
+static void test_history_range_queries()
+{
+    const time_t  start_time = 1639000000;
+    const size_t  readings   = 20000;
+    CountHistory  history(100);
+    CountData     range_data = {0};
+    vector<unsigned int> counts(readings);
+    unsigned long long total = 0;
+    unsigned int  min_cps    = 0;
+    unsigned int  max_cps    = 0;
+    unsigned int  expected   = 0;
+    size_t        first      = 0;
+    size_t        last       = 0;
+    size_t        i          = 0;
+    size_t        j          = 0;
+
+    srand(1);
+    for (i = 0; i < readings; i++)
+    {
+        counts[i] = rand() % 1000;
+        history.append(start_time + i, counts[i]);
+    }
+
+    /* only the newest readings still fit in the ring */
+    first = readings - history.number_of_samples();
+
+    for (i = 0; i < 2000; i++)
+    {
+        size_t a = first + rand() % (readings - first);
+        size_t b = first + rand() % (readings - first);
+
+        if (b < a)
+        {
+            swap(a, b);
+        }
+
+        total = 0;
+        min_cps = counts[a];
+        max_cps = counts[a];
+        for (j = a; j <= b; j++)
+        {
+            total += counts[j];
+            min_cps = min(min_cps, counts[j]);
+            max_cps = max(max_cps, counts[j]);
+        }
+        expected = b - a + 1;
+
+        if (!history.query(start_time + a, start_time + b, range_data) ||
+            (range_data.total_counts != total) || (range_data.number_of_readings != expected) ||
+            (range_data.min_cps != min_cps) || (range_data.max_cps != max_cps) ||
+            (range_data.first_epoch_time_seconds != (time_t)(start_time + a)) ||
+            (range_data.last_epoch_time_seconds != (time_t)(start_time + b)))
+        {
+            cerr << "history range query " << a << "-" << b << " returned wrong stats" << endl;
+            break;
+        }
+    }
+
+    /* ranges hanging off either end only count what is stored */
+    last = readings - 1;
+    if (!history.query(0, start_time + last + 100, range_data) ||
+        (range_data.number_of_readings != readings - first))
+    {
+        cerr << "history range query over everything returned wrong stats" << endl;
+    }
+}
+
+/**
+ * \brief Test stats are restored from a checkpoint file and that a bad
+ *        file starts with invalid stats.
+ * 
+ * \return void
+ */
+static void test_persistent_checkpoint()
+{
+    const char    *checkpoint_path = "test_checkpoint.bin";
+    GammaData      previous        = {0};
+    GammaData      saved           = {0};
+    GammaData      restored        = {0};
+    FILE          *p_file          = NULL;
+    CheckpointFile file            = {0};
+    int            newest          = 0;
+    int            fd              = -1;
+
+    unlink(checkpoint_path);
+
+    {
+        GammaStats gamma_stats(checkpoint_path);
+
+        if (gamma_stats.count_stats_get(saved))
+        {
+            cerr << "new checkpoint did not start with invalid stats" << endl;
+        }
+
+        gamma_stats.count_stats_update(7);
+        gamma_stats.count_stats_update(3);
+        gamma_stats.count_stats_get(previous);
+        gamma_stats.count_stats_update(11);
+        gamma_stats.count_stats_get(saved);
+    }
+
+    /* "restart" */
+    {
+        GammaStats gamma_stats(checkpoint_path);
+
+        if (!gamma_stats.count_stats_get(restored) ||
+            (0 != memcmp(&saved, &restored, sizeof(GammaData))))
+        {
+            cerr << "checkpoint failed to restore stats" << endl;
+        }
+    }
+
+    /* crash part way through saving the newest record */
+    fd = open(checkpoint_path, O_RDWR);
+    if ((fd < 0) || (sizeof(file) != pread(fd, &file, sizeof(file), 0)))
+    {
+        cerr << "failed to read checkpoint file" << endl;
+    }
+    else
+    {
+        newest = (file.records[0].sequence < file.records[1].sequence) ? 1 : 0;
+        file.records[newest].c_stats.total_counts ^= 0x40;
+        if (sizeof(file) != pwrite(fd, &file, sizeof(file), 0))
+        {
+            cerr << "failed to write checkpoint file" << endl;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    {
+        GammaStats gamma_stats(checkpoint_path);
+
+        if (!gamma_stats.count_stats_get(restored) ||
+            (0 != memcmp(&previous, &restored, sizeof(GammaData))))
+        {
+            cerr << "checkpoint failed to fall back to the previous record" << endl;
+        }
+    }
+
+    /* the checkpoint follows count_stats_get_and_reset to the new interval */
+    {
+        GammaStats gamma_stats(checkpoint_path);
+
+        gamma_stats.count_stats_update(5);
+        gamma_stats.count_stats_get_and_reset(restored);
+    }
+
+    {
+        GammaStats gamma_stats(checkpoint_path);
+
+        if (gamma_stats.count_stats_get(restored))
+        {
+            cerr << "checkpoint restored an interval already handed back" << endl;
+        }
+    }
+
+    /* garbage in the file is thrown away */
+    p_file = fopen(checkpoint_path, "w");
+    if (p_file)
+    {
+        fputs("not a checkpoint", p_file);
+        fclose(p_file);
+    }
+
+    {
+        GammaStats gamma_stats(checkpoint_path);
+
+        if (gamma_stats.count_stats_get(restored))
+        {
+            cerr << "bad checkpoint was not thrown away" << endl;
+        }
+    }
+
+    unlink(checkpoint_path);
+}
+
+/**
+ * \brief Returns true if a subscriber has been woken, acking the wakeup
+ * 
+ * \param gamma_stats - GammaStats object subscribed to
+ * \param poll_fd     - fd from count_stats_subscribe
+ * \param timeout_ms  - how long to wait for the wakeup
+ * 
+ * \return bool - true if woken
+ */
+static bool subscriber_woken(GammaStats &gamma_stats, int poll_fd, int timeout_ms = 0)
+{
+    struct pollfd poll_entry = {};
+
+    poll_entry.fd     = poll_fd;
+    poll_entry.events = POLLIN;
+
+    if (1 != poll(&poll_entry, 1, timeout_ms))
+    {
+        return false;
+    }
+
+    gamma_stats.count_stats_ack(poll_fd);
+
+    return true;
+}
+
+/**
+ * \brief Test subscribers are only woken once their threshold and
+ *        interval have been met.
+ * 
+ * \param gamma_stats - GammaStats object
+ * 
+ * \return void
+ */
+static void test_subscriptions(GammaStats &gamma_stats)
+{
+    int threshold_fd = gamma_stats.count_stats_subscribe(0, 10);
+    int interval_fd  = gamma_stats.count_stats_subscribe(3600, 0);
+
+    if ((threshold_fd < 0) || (interval_fd < 0))
+    {
+        cerr << "count_stats_subscribe failed" << endl;
+        return;
+    }
+
+    gamma_stats.count_stats_update(3);
+    if (subscriber_woken(gamma_stats, threshold_fd))
+    {
+        cerr << "subscriber woken before threshold" << endl;
+    }
+    if (!subscriber_woken(gamma_stats, interval_fd))
+    {
+        cerr << "subscriber not woken by first update" << endl;
+    }
+
+    gamma_stats.count_stats_update(8);
+    gamma_stats.count_stats_update(20);
+    if (!subscriber_woken(gamma_stats, threshold_fd))
+    {
+        cerr << "subscriber not woken after threshold" << endl;
+    }
+    if (subscriber_woken(gamma_stats, interval_fd))
+    {
+        cerr << "subscriber woken inside interval" << endl;
+    }
+
+    gamma_stats.count_stats_reset();
+    if (!subscriber_woken(gamma_stats, interval_fd))
+    {
+        cerr << "subscriber not woken by reset" << endl;
+    }
+
+    if (!gamma_stats.count_stats_unsubscribe(threshold_fd) ||
+        !gamma_stats.count_stats_unsubscribe(interval_fd) ||
+        gamma_stats.count_stats_unsubscribe(interval_fd))
+    {
+        cerr << "count_stats_unsubscribe failed" << endl;
+    }
+}
+
+/**
+ * \brief Test a change held back by the interval still wakes the
+ *        subscriber once the interval ends, and that a burst of updates
+ *        is a single wakeup.
+ * 
+ * \param gamma_stats - GammaStats object
+ * 
+ * \return void
+ */
+static void test_held_back_subscriptions(GammaStats &gamma_stats)
+{
+    int       interval_fd = gamma_stats.count_stats_subscribe(2, 0);
+    int       burst_fd    = gamma_stats.count_stats_subscribe(0, 0);
+    int       period_fd   = gamma_stats.count_stats_subscribe(0, 1000);
+    GammaData period      = {0};
+
+    if ((interval_fd < 0) || (burst_fd < 0) || (period_fd < 0))
+    {
+        cerr << "count_stats_subscribe failed" << endl;
+        return;
+    }
+
+    gamma_stats.count_stats_update(1);
+    if (!subscriber_woken(gamma_stats, interval_fd))
+    {
+        cerr << "subscriber not woken by first update" << endl;
+    }
+
+    /* held back by the interval, then nothing else comes in */
+    gamma_stats.count_stats_update(1);
+    if (subscriber_woken(gamma_stats, interval_fd))
+    {
+        cerr << "subscriber woken inside interval" << endl;
+    }
+    if (!subscriber_woken(gamma_stats, interval_fd, 4000))
+    {
+        cerr << "held back change never woke subscriber" << endl;
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        gamma_stats.count_stats_update(1);
+    }
+    if (!subscriber_woken(gamma_stats, burst_fd) ||
+        subscriber_woken(gamma_stats, burst_fd))
+    {
+        cerr << "burst of updates was not one wakeup" << endl;
+    }
+
+    /* starting a new period is a reset, whatever the threshold */
+    gamma_stats.count_stats_get_and_reset(period);
+    if (!subscriber_woken(gamma_stats, period_fd))
+    {
+        cerr << "subscriber not woken by count_stats_get_and_reset" << endl;
+    }
+
+    gamma_stats.count_stats_unsubscribe(interval_fd);
+    gamma_stats.count_stats_unsubscribe(burst_fd);
+    gamma_stats.count_stats_unsubscribe(period_fd);
+}
+
+/**
+ * \brief Test coincidences are found across detectors and only once
+ *        every detector has moved past them.
+ * 
+ * \return void
+ */
+static void test_coincidences()
+{
+    CoincidenceStats coincidences(3, 100);
+    CountData        coincidence_data = {0};
+
+    coincidences.coincidence_push(0, 1000);
+    coincidences.coincidence_push(0, 5000);
+    coincidences.coincidence_push(0, 9000);
+    coincidences.coincidence_push(1, 1050);
+    coincidences.coincidence_push(1, 7000);
+    coincidences.coincidence_push(1, 9020);
+    coincidences.coincidence_push(2, 3000);
+    coincidences.coincidence_push(2, 9500);
+
+    if (coincidences.coincidence_push(2, 2000))
+    {
+        cerr << "coincidence push took an out of order event" << endl;
+    }
+
+    /* detector 0 has only reached 9000, 9020 on detector 1 is not merged yet */
+    if (1 != coincidences.coincidence_process())
+    {
+        cerr << "coincidence process found the wrong number of coincidences" << endl;
+    }
+
+    if (1 != coincidences.coincidence_flush())
+    {
+        cerr << "coincidence flush found the wrong number of coincidences" << endl;
+    }
+
+    /* both are in the first second of event time */
+    if (!coincidences.coincidence_stats().count_stats_get(coincidence_data) ||
+        (coincidence_data.total_counts != 2) || (coincidence_data.number_of_readings != 1))
+    {
+        cerr << "coincidence stats are wrong" << endl;
+    }
+
+    /* straddles where a fixed window starting at 0 would end */
+    CoincidenceStats straddle(2, 100);
+
+    straddle.coincidence_push(0, 0);
+    straddle.coincidence_push(0, 90);
+    straddle.coincidence_push(1, 110);
+    if (1 != straddle.coincidence_flush())
+    {
+        cerr << "coincidence straddling a window boundary was missed" << endl;
+    }
+
+    /* three detectors in one window are still one coincidence */
+    CoincidenceStats triple(3, 100);
+
+    triple.coincidence_push(0, 1000);
+    triple.coincidence_push(1, 1040);
+    triple.coincidence_push(2, 1080);
+    triple.coincidence_push(2, 1200);
+    if (1 != triple.coincidence_flush())
+    {
+        cerr << "coincidence of three detectors was not counted once" << endl;
+    }
+}
+
+/**
+ * \brief Test coincidences are reported once per second of event time,
+ *        not once per process call.
+ * 
+ * \return void
+ */
+static void test_coincidence_seconds()
+{
+    const unsigned long long second_ns = COINCIDENCE_NS_PER_SECOND;
+    const unsigned long long starts[]  = {100000000, 200000000, 1500000000,
+                                          3100000000, 3200000000, 3300000000};
+    CoincidenceStats         coincidences(2, 100);
+    CountData                coincidence_data = {0};
+
+    for (unsigned long long start_ns : starts)
+    {
+        coincidences.coincidence_push(0, start_ns);
+        coincidences.coincidence_push(1, start_ns + 10);
+
+        /* extra calls must not add readings */
+        coincidences.coincidence_process();
+    }
+
+    coincidences.coincidence_advance(0, 3 * second_ns + second_ns / 2);
+    coincidences.coincidence_advance(1, 3 * second_ns + second_ns / 2);
+    coincidences.coincidence_process();
+
+    /* seconds 0 to 2 are done, 2 had nothing in it */
+    if (!coincidences.coincidence_stats().count_stats_get(coincidence_data) ||
+        (coincidence_data.number_of_readings != 3) || (coincidence_data.total_counts != 3) ||
+        (coincidence_data.min_cps != 0) || (coincidence_data.max_cps != 2))
+    {
+        cerr << "coincidence seconds are wrong before flush" << endl;
+    }
+
+    coincidences.coincidence_flush();
+
+    if (!coincidences.coincidence_stats().count_stats_get(coincidence_data) ||
+        (coincidence_data.number_of_readings != 4) || (coincidence_data.total_counts != 6) ||
+        (coincidence_data.max_cps != 3))
+    {
+        cerr << "coincidence seconds are wrong after flush" << endl;
+    }
+}
+
+/**
+ * \brief Sorts events by time, then detector, the order the merge takes
+ *        them in.
+ * 
+ * \param events - events to sort
+ * 
+ * \return void
+ */
+static void sort_events(vector<WindowEvent> &events)
+{
+    sort(events.begin(), events.end(),
+         [](const WindowEvent &a, const WindowEvent &b)
+         {
+             return (a.time_ns < b.time_ns) ||
+                    ((a.time_ns == b.time_ns) && (a.detector < b.detector));
+         });
+}
+
+/**
+ * \brief Straight from the documented greedy rule: walking events in time
+ *        order, a coincidence starts at the oldest event within a window
+ *        of the current one, after the last coincidence, once those
+ *        events cover min_detectors detectors. It takes every event up to
+ *        a window after its start. No state is carried between steps, so
+ *        it is slow but simple to check by eye.
+ * 
+ * \param events        - events sorted by time, then detector
+ * \param window_ns     - coincidence window
+ * \param min_detectors - different detectors needed for a coincidence
+ * \param per_second    - filled with coincidences per second of event
+ *                        time, from the second of the first event
+ * 
+ * \return unsigned long long - coincidences found
+ */
+static unsigned long long coincidence_reference(const vector<WindowEvent> &events,
+                                                unsigned long long window_ns,
+                                                unsigned int min_detectors,
+                                                vector<unsigned int> &per_second)
+{
+    unsigned long long found   = 0;
+    unsigned long long end_ns  = 0;
+    unsigned int       seen    = 0;
+    size_t             after   = 0;
+    size_t             j       = 0;
+    size_t             k       = 0;
+
+    per_second.clear();
+    if (!events.empty())
+    {
+        per_second.resize(events.back().time_ns / COINCIDENCE_NS_PER_SECOND -
+                          events.front().time_ns / COINCIDENCE_NS_PER_SECOND + 1);
+    }
+
+    for (j = 0; j < events.size(); j++)
+    {
+        seen = 0;
+        for (k = j + 1; (k > after) && (events[k - 1].time_ns + window_ns >= events[j].time_ns); k--)
+        {
+            seen |= 1u << events[k - 1].detector;
+        }
+
+        if ((unsigned int)__builtin_popcount(seen) < min_detectors)
+        {
+            continue;
+        }
+
+        /* events[k] is the oldest in reach, where the coincidence starts */
+        found++;
+        per_second[events[k].time_ns / COINCIDENCE_NS_PER_SECOND -
+                   events.front().time_ns / COINCIDENCE_NS_PER_SECOND]++;
+
+        end_ns = events[k].time_ns + window_ns;
+        while ((j + 1 < events.size()) && (events[j + 1].time_ns <= end_ns))
+        {
+            j++;
+        }
+        after = j + 1;
+    }
+
+    return found;
+}
+
+/**
+ * \brief Makes a seeded stream of events in time order. Events come in
+ *        clusters far enough apart that only events in the same cluster
+ *        can be within a window of each other. A cluster is one event, a
+ *        pair on two detectors, a pair on one detector, or a pair on one
+ *        detector followed by an event on another that is only in reach
+ *        of the second.
+ * 
+ * \param clusters  - number of clusters
+ * \param window_ns - coincidence window
+ * \param detectors - number of detectors, at least 2
+ * \param events    - filled with the stream
+ * 
+ * \return unsigned long long - coincidences in the stream
+ */
+static unsigned long long coincidence_stream(size_t clusters, unsigned long long window_ns,
+                                             unsigned int detectors, vector<WindowEvent> &events)
+{
+    unsigned long long expected = 0;
+    unsigned long long start_ns = 0;
+    unsigned long long offset   = 0;
+    unsigned int       first    = 0;
+    unsigned int       second   = 0;
+
+    events.clear();
+
+    for (size_t i = 0; i < clusters; i++)
+    {
+        /* clusters span at most 2 windows, so gaps are over a window */
+        start_ns += 3 * window_ns + 1 + rand() % window_ns;
+        first     = rand() % detectors;
+        second    = (first + 1 + rand() % (detectors - 1)) % detectors;
+
+        events.push_back({start_ns, first});
+
+        switch (rand() % 4)
+        {
+            case 1:
+                events.push_back({start_ns + rand() % (window_ns + 1), second});
+                expected++;
+                break;
+            case 2:
+                events.push_back({start_ns + rand() % (window_ns + 1), first});
+                break;
+            case 3:
+                offset = window_ns / 2 + 1 + rand() % (window_ns / 2);
+                events.push_back({start_ns + offset, first});
+                events.push_back({start_ns + window_ns + 1 + rand() % offset, second});
+                expected++;
+                break;
+            default:
+                break;
+        }
+    }
+
+    sort_events(events);
+
+    return expected;
+}
+
+/**
+ * \brief Makes a seeded stream with every gap under 2 windows, so windows
+ *        overlap all the time and which events start a coincidence
+ *        depends on the ones before.
+ * 
+ * \param count       - number of events
+ * \param max_gap_ns  - gaps are 0 up to this
+ * \param detectors   - number of detectors
+ * \param events      - filled with the stream
+ * 
+ * \return void
+ */
+static void dense_coincidence_stream(size_t count, unsigned long long max_gap_ns,
+                                     unsigned int detectors, vector<WindowEvent> &events)
+{
+    unsigned long long time_ns = 0;
+
+    events.clear();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        time_ns += rand() % (max_gap_ns + 1);
+        events.push_back({time_ns, (unsigned int)(rand() % detectors)});
+    }
+
+    sort_events(events);
+}
+
+/**
+ * \brief Pushes a stream, processing every few events so windows are
+ *        split across calls.
+ * 
+ * \param coincidences - counter to push to
+ * \param events       - stream in time order
+ * \param every        - events pushed between process calls
+ * 
+ * \return unsigned long long - coincidences found
+ */
+static unsigned long long run_coincidences(CoincidenceStats &coincidences,
+                                           const vector<WindowEvent> &events, size_t every)
+{
+    unsigned long long found = 0;
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        if (!coincidences.coincidence_push(events[i].detector, events[i].time_ns))
+        {
+            cerr << "coincidence push failed" << endl;
+        }
+
+        if (every - 1 == i % every)
+        {
+            found += coincidences.coincidence_process();
+        }
+    }
+
+    return found + coincidences.coincidence_flush();
+}
+
+/**
+ * \brief Checks the merge against counting every pair of events on
+ *        different detectors within a window, O(n^2) so kept small,
+ *        and against the reference.
+ * 
+ * \return void
+ */
+static void test_coincidences_brute_force()
+{
+    const unsigned long long window_ns = 100;
+    CoincidenceStats         coincidences(3, window_ns);
+    vector<WindowEvent>      events;
+    vector<unsigned int>     per_second;
+    unsigned long long       expected  = 0;
+    unsigned long long       pairs     = 0;
+    unsigned long long       found     = 0;
+
+    srand(3);
+    expected = coincidence_stream(500, window_ns, 3, events);
+
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        for (size_t j = i + 1; j < events.size(); j++)
+        {
+            if ((events[i].detector != events[j].detector) &&
+                (events[j].time_ns - events[i].time_ns <= window_ns))
+            {
+                pairs++;
+            }
+        }
+    }
+
+    found = run_coincidences(coincidences, events, 101);
+
+    if ((pairs != expected) || (found != pairs) ||
+        (found != coincidence_reference(events, window_ns, 2, per_second)))
+    {
+        cerr << "coincidences found " << found << " brute force " << pairs << endl;
+    }
+}
+
+/**
+ * \brief Checks the merge against the reference on dense streams where
+ *        windows overlap, with more detectors than a coincidence needs.
+ * 
+ * \return void
+ */
+static void test_coincidences_reference()
+{
+    const unsigned long long window_ns = 100;
+    vector<WindowEvent>      events;
+    vector<unsigned int>     per_second;
+    unsigned long long       expected  = 0;
+    unsigned long long       found     = 0;
+
+    srand(4);
+
+    for (unsigned int detectors = 3; detectors <= 5; detectors++)
+    {
+        for (unsigned int min_detectors = 2; min_detectors <= 3; min_detectors++)
+        {
+            CoincidenceStats coincidences(detectors, window_ns, min_detectors);
+
+            dense_coincidence_stream(20000, 2 * window_ns, detectors, events);
+            expected = coincidence_reference(events, window_ns, min_detectors, per_second);
+            found    = run_coincidences(coincidences, events, 37);
+
+            if ((found != expected) || (0 == expected))
+            {
+                cerr << "coincidences of " << min_detectors << " of " << detectors <<
+                    " detectors found " << found << " reference " << expected << endl;
+            }
+        }
+    }
+}
+
+/**
+ * \brief Times merging a few MHz of events from 4 detectors over a few
+ *        seconds of event time, and checks the per second stats.
+ * 
+ * \return void
+ */
+static void test_coincidence_rate()
+{
+    const unsigned int       detectors = 4;
+    const unsigned long long window_ns = 50;
+    CoincidenceStats         coincidences(detectors, window_ns);
+    CountData                coincidence_data = {0};
+    vector<WindowEvent>      events;
+    vector<unsigned int>     per_second;
+    unsigned long long       expected  = 0;
+    unsigned long long       found     = 0;
+    size_t                   failed    = 0;
+    size_t                   i         = 0;
+    unsigned int             d         = 0;
+
+    srand(2);
+    dense_coincidence_stream(4000000, 2 * 1000 - 1, detectors, events);
+    expected = coincidence_reference(events, window_ns, 2, per_second);
+
+    auto start = chrono::steady_clock::now();
+
+    for (i = 0; i < events.size(); i++)
+    {
+        if (!coincidences.coincidence_push(events[i].detector, events[i].time_ns))
+        {
+            failed++;
+        }
+
+        if (999 == i % 1000)
+        {
+            /* quiet detectors would otherwise hold the merge back */
+            for (d = 0; d < detectors; d++)
+            {
+                coincidences.coincidence_advance(d, events[i].time_ns);
+            }
+            found += coincidences.coincidence_process();
+        }
+    }
+    found += coincidences.coincidence_flush();
+
+    chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+
+    if (failed || (found != expected))
+    {
+        cerr << "coincidence rate run lost events, " << failed << " pushes failed, found " <<
+            found << " of " << expected << endl;
+    }
+
+    if (!coincidences.coincidence_stats().count_stats_get(coincidence_data) ||
+        (coincidence_data.total_counts != found) ||
+        (coincidence_data.number_of_readings != per_second.size()) ||
+        (coincidence_data.max_cps != *max_element(per_second.begin(), per_second.end())) ||
+        (coincidence_data.min_cps != *min_element(per_second.begin(), per_second.end())))
+    {
+        cerr << "coincidence rate stats do not match the reference" << endl;
+    }
+
+    cout << "Coincidences: " << found << " over " << coincidence_data.number_of_readings <<
+        " s of event time, " << coincidence_data.max_cps / 1e6 << " M/s at most, merged " <<
+        events.size() / seconds.count() / 1e6 << " M events/s" << endl;
+}
+
+/**
+ * \brief Test no counts are lost when one thread reports periods with
+ *        count_stats_get_and_reset while another is updating.
+ * 
+ * \return void
+ */
+static void test_get_and_reset_with_threads()
+{
+    const unsigned int updates  = 200000;
+    GammaStats         gamma_stats;
+    GammaData          period   = {0};
+    atomic<bool>       done(false);
+    unsigned long long reported = 0;
+    unsigned int       periods  = 0;
+
+    if (gamma_stats.count_stats_get_and_reset(period))
+    {
+        cerr << "count stats get and reset returned an empty period" << endl;
+    }
+
+    thread writer([&]() {
+        for (unsigned int i = 0; i < updates; i++)
+        {
+            gamma_stats.count_stats_update(1);
+        }
+        done = true;
+    });
+
+    while (!done)
+    {
+        if (gamma_stats.count_stats_get_and_reset(period))
+        {
+            reported += period.total_counts;
+            periods++;
+        }
+    }
+    writer.join();
+
+    if (gamma_stats.count_stats_get_and_reset(period))
+    {
+        reported += period.total_counts;
+        periods++;
+    }
+
+    cout << "Reported " << reported << " counts over " << periods << " periods" << endl;
+
+    if (reported != updates)
+    {
+        cerr << "count stats get and reset lost counts" << endl;
+    }
 }
 
 /****************** Public Functions ****************/
@@ -77,6 +991,17 @@ int main()
 
     test_failure_cases_with_valid_handle(gstats);
     test_good_cases_with_single_thread(gstats);
+    test_subscriptions(gstats);
+    test_held_back_subscriptions(gstats);
+    test_coincidences();
+    test_coincidence_seconds();
+    test_coincidences_brute_force();
+    test_coincidences_reference();
+    test_coincidence_rate();
+    test_get_and_reset_with_threads();
+    test_history_compression();
+    test_history_range_queries();
+    test_persistent_checkpoint();
 
     /* Could add tests here for mutexes with multiple threads */
 
@@ -9,8 +9,13 @@
 /****************** Includes ************************/
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include "gammaStats.h"
+#include "countCheckpoint.h"
 
 /***************** Private Functions ****************/
 /**
@@ -123,6 +128,329 @@ static void test_good_cases_with_single_thread(GStatsHandle *p_gstats_handle)
 
 }
 
+/**
+ * \brief Test stats are restored from a checkpoint file and that a bad
+ *        file starts with invalid stats.
+ * 
+ * \return void
+ */
+static void test_persistent_checkpoint()
+{
+    const char   *p_path          = "test_checkpoint.bin";
+    GStatsHandle *p_gstats_handle = NULL;
+    GammaStats    previous        = {0};
+    GammaStats    saved           = {0};
+    GammaStats    restored        = {0};
+    FILE         *p_file          = NULL;
+    CheckpointFile file           = {0};
+    int           newest          = 0;
+    int           fd              = -1;
+
+    unlink(p_path);
+
+    p_gstats_handle = count_stats_new_persistent(p_path);
+    if (!p_gstats_handle)
+    {
+        printf("failed to create persistent gstats handle\n");
+        return;
+    }
+
+    if (count_stats_get(p_gstats_handle, &saved))
+    {
+        printf("new checkpoint did not start with invalid stats\n");
+    }
+
+    count_stats_update(p_gstats_handle, 7);
+    count_stats_update(p_gstats_handle, 3);
+    count_stats_get(p_gstats_handle, &previous);
+    count_stats_update(p_gstats_handle, 11);
+    count_stats_get(p_gstats_handle, &saved);
+    count_stats_destroy(&p_gstats_handle);
+
+    /* "restart" */
+    p_gstats_handle = count_stats_new_persistent(p_path);
+    if (!p_gstats_handle || !count_stats_get(p_gstats_handle, &restored) ||
+        (0 != memcmp(&saved, &restored, sizeof(GammaStats))))
+    {
+        printf("checkpoint failed to restore stats\n");
+    }
+    count_stats_destroy(&p_gstats_handle);
+
+    /* crash part way through saving the newest record */
+    fd = open(p_path, O_RDWR);
+    if ((fd < 0) || (sizeof(file) != pread(fd, &file, sizeof(file), 0)))
+    {
+        printf("failed to read checkpoint file\n");
+    }
+    else
+    {
+        newest = (file.records[0].sequence < file.records[1].sequence) ? 1 : 0;
+        file.records[newest].c_stats.total_counts ^= 0x40;
+        if (sizeof(file) != pwrite(fd, &file, sizeof(file), 0))
+        {
+            printf("failed to write checkpoint file\n");
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    p_gstats_handle = count_stats_new_persistent(p_path);
+    if (!p_gstats_handle || !count_stats_get(p_gstats_handle, &restored) ||
+        (0 != memcmp(&previous, &restored, sizeof(GammaStats))))
+    {
+        printf("checkpoint failed to fall back to the previous record\n");
+    }
+    count_stats_destroy(&p_gstats_handle);
+
+    /* the checkpoint follows count_stats_get_and_reset to the new interval */
+    p_gstats_handle = count_stats_new_persistent(p_path);
+    if (p_gstats_handle)
+    {
+        count_stats_update(p_gstats_handle, 5);
+        count_stats_get_and_reset(p_gstats_handle, &restored);
+        count_stats_destroy(&p_gstats_handle);
+    }
+
+    p_gstats_handle = count_stats_new_persistent(p_path);
+    if (!p_gstats_handle || count_stats_get(p_gstats_handle, &restored))
+    {
+        printf("checkpoint restored an interval already handed back\n");
+    }
+    count_stats_destroy(&p_gstats_handle);
+
+    /* garbage in the file is thrown away */
+    p_file = fopen(p_path, "w");
+    if (p_file)
+    {
+        fputs("not a checkpoint", p_file);
+        fclose(p_file);
+    }
+
+    p_gstats_handle = count_stats_new_persistent(p_path);
+    if (!p_gstats_handle || count_stats_get(p_gstats_handle, &restored))
+    {
+        printf("bad checkpoint was not thrown away\n");
+    }
+    count_stats_destroy(&p_gstats_handle);
+
+    unlink(p_path);
+}
+
+/**
+ * \brief Returns true if a subscriber has been woken, acking the wakeup
+ * 
+ * \param p_gstats_handle - handle the subscriber is watching
+ * \param poll_fd         - fd from count_stats_subscribe
+ * \param timeout_ms      - how long to wait for the wakeup
+ * 
+ * \return bool - true if woken
+ */
+static bool subscriber_woken(GStatsHandle *p_gstats_handle, int poll_fd, int timeout_ms)
+{
+    struct pollfd poll_entry = {0};
+
+    poll_entry.fd     = poll_fd;
+    poll_entry.events = POLLIN;
+
+    if (1 != poll(&poll_entry, 1, timeout_ms))
+    {
+        return false;
+    }
+
+    count_stats_ack(p_gstats_handle, poll_fd);
+
+    return true;
+}
+
+/**
+ * \brief Test subscribers are only woken once their threshold and
+ *        interval have been met.
+ * 
+ * \param p_gstats_handle - handle to test.
+ * 
+ * \return void
+ */
+static void test_subscriptions(GStatsHandle *p_gstats_handle)
+{
+    int threshold_fd = count_stats_subscribe(p_gstats_handle, 0, 10);
+    int interval_fd  = count_stats_subscribe(p_gstats_handle, 3600, 0);
+
+    if ((threshold_fd < 0) || (interval_fd < 0))
+    {
+        printf("count_stats_subscribe failed\n");
+        return;
+    }
+
+    count_stats_update(p_gstats_handle, 3);
+    if (subscriber_woken(p_gstats_handle, threshold_fd, 0))
+    {
+        printf("subscriber woken before threshold\n");
+    }
+    if (!subscriber_woken(p_gstats_handle, interval_fd, 0))
+    {
+        printf("subscriber not woken by first update\n");
+    }
+
+    count_stats_update(p_gstats_handle, 8);
+    count_stats_update(p_gstats_handle, 20);
+    if (!subscriber_woken(p_gstats_handle, threshold_fd, 0))
+    {
+        printf("subscriber not woken after threshold\n");
+    }
+    if (subscriber_woken(p_gstats_handle, interval_fd, 0))
+    {
+        printf("subscriber woken inside interval\n");
+    }
+
+    count_stats_reset(p_gstats_handle);
+    if (!subscriber_woken(p_gstats_handle, interval_fd, 0))
+    {
+        printf("subscriber not woken by reset\n");
+    }
+
+    if (!count_stats_unsubscribe(p_gstats_handle, threshold_fd) ||
+        !count_stats_unsubscribe(p_gstats_handle, interval_fd) ||
+        count_stats_unsubscribe(p_gstats_handle, interval_fd))
+    {
+        printf("count_stats_unsubscribe failed\n");
+    }
+}
+
+/**
+ * \brief Test a change held back by the interval still wakes the
+ *        subscriber when no more updates come in, and that a burst of
+ *        updates is one wakeup.
+ * 
+ * \param p_gstats_handle - handle to test.
+ * 
+ * \return void
+ */
+static void test_held_back_subscriptions(GStatsHandle *p_gstats_handle)
+{
+    int        interval_fd = count_stats_subscribe(p_gstats_handle, 2, 0);
+    int        burst_fd    = count_stats_subscribe(p_gstats_handle, 0, 0);
+    int        period_fd   = count_stats_subscribe(p_gstats_handle, 0, 1000);
+    GammaStats period      = {0};
+    int        i           = 0;
+
+    if ((interval_fd < 0) || (burst_fd < 0) || (period_fd < 0))
+    {
+        printf("count_stats_subscribe failed\n");
+        return;
+    }
+
+    count_stats_update(p_gstats_handle, 1);
+    if (!subscriber_woken(p_gstats_handle, interval_fd, 0))
+    {
+        printf("subscriber not woken by first update\n");
+    }
+
+    /* held back by the interval, then nothing else comes in */
+    count_stats_update(p_gstats_handle, 1);
+    if (subscriber_woken(p_gstats_handle, interval_fd, 0))
+    {
+        printf("subscriber woken inside interval\n");
+    }
+    if (!subscriber_woken(p_gstats_handle, interval_fd, 4000))
+    {
+        printf("held back change never woke subscriber\n");
+    }
+
+    for (i = 0; i < 100; i++)
+    {
+        count_stats_update(p_gstats_handle, 1);
+    }
+    if (!subscriber_woken(p_gstats_handle, burst_fd, 0) ||
+        subscriber_woken(p_gstats_handle, burst_fd, 0))
+    {
+        printf("burst of updates was not one wakeup\n");
+    }
+
+    /* starting a new period is a reset, whatever the threshold */
+    count_stats_get_and_reset(p_gstats_handle, &period);
+    if (!subscriber_woken(p_gstats_handle, period_fd, 0))
+    {
+        printf("subscriber not woken by count_stats_get_and_reset\n");
+    }
+
+    count_stats_unsubscribe(p_gstats_handle, interval_fd);
+    count_stats_unsubscribe(p_gstats_handle, burst_fd);
+    count_stats_unsubscribe(p_gstats_handle, period_fd);
+}
+
+/**
+ * \brief Updates a handle from its own thread for the get and reset test
+ * 
+ * \param p_arg - handle to update
+ * 
+ * \return void* - always NULL
+ */
+static void *update_thread(void *p_arg)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < 200000; i++)
+    {
+        count_stats_update((GStatsHandle *)p_arg, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Test no counts are lost when periods are reported with
+ *        count_stats_get_and_reset while another thread is updating.
+ * 
+ * \return void
+ */
+static void test_get_and_reset_with_threads()
+{
+    GStatsHandle      *p_gstats_handle = count_stats_new();
+    GammaStats         period          = {0};
+    pthread_t          writer;
+    unsigned long long reported        = 0;
+    int                i               = 0;
+
+    if (!p_gstats_handle)
+    {
+        printf("failed to create gstats handle\n");
+        return;
+    }
+
+    if (count_stats_get_and_reset(NULL, &period) ||
+        count_stats_get_and_reset(p_gstats_handle, NULL) ||
+        count_stats_get_and_reset(p_gstats_handle, &period))
+    {
+        printf("count_stats_get_and_reset failed to fail\n");
+    }
+
+    pthread_create(&writer, NULL, update_thread, p_gstats_handle);
+
+    for (i = 0; i < 1000; i++)
+    {
+        if (count_stats_get_and_reset(p_gstats_handle, &period))
+        {
+            reported += period.total_counts;
+        }
+    }
+
+    pthread_join(writer, NULL);
+
+    if (count_stats_get_and_reset(p_gstats_handle, &period))
+    {
+        reported += period.total_counts;
+    }
+
+    if (200000 != reported)
+    {
+        printf("count_stats_get_and_reset lost counts\n");
+    }
+
+    count_stats_destroy(&p_gstats_handle);
+}
+
 /****************** Public Functions ****************/
 void main()
 {
@@ -144,10 +472,15 @@ void main()
     {
         test_failure_cases_with_valid_handle(p_gstats_handle);
         test_good_cases_with_single_thread(p_gstats_handle);
+        test_subscriptions(p_gstats_handle);
+        test_held_back_subscriptions(p_gstats_handle);
 
         /* Could add tests here for mutexes with multiple threads */
 
         /* Destroy memory before exiting */
         count_stats_destroy(&p_gstats_handle);
     }
+
+    test_persistent_checkpoint();
+    test_get_and_reset_with_threads();
 }
\ No newline at end of file